@@ -40,6 +40,22 @@ static void __make_cq_entry(int eid, u16 ret) { __make_cq_entry_results(eid, ret
 /***
  * Queue managements
  */
+static void __reset_dbbuf(int dbs_idx)
+{
+	u32 *dbbuf_dbs = nvmev_vdev->dbbuf_dbs;
+
+	if (dbbuf_dbs) {
+		dbbuf_dbs[dbs_idx] = 0;
+		nvmev_vdev->dbbuf_eis[dbs_idx] = -1;
+	}
+}
+
+static void __set_cq_irq_coalesce(struct nvmev_completion_queue *cq)
+{
+	cq->irq_coalesce_thr = nvmev_vdev->irq_coalesce_thr;
+	cq->irq_coalesce_nsecs = nvmev_vdev->irq_coalesce_time * 100ULL * 1000;
+}
+
 static void __nvmev_admin_create_cq(int eid)
 {
 	struct nvmev_admin_queue *queue = nvmev_vdev->admin_q;
@@ -57,14 +73,14 @@ static void __nvmev_admin_create_cq(int eid)
 		cq->irq_vector = cmd->irq_vector;
 	}
 	cq->interrupt_ready = false;
+	__set_cq_irq_coalesce(cq);
 
 	cq->queue_size = cmd->qsize + 1;
-	cq->phase = 1;
 
-	cq->cq_head = 0;
+	atomic64_set(&cq->nr_reserved, 0);
 	cq->cq_tail = -1;
 
-	spin_lock_init(&cq->entry_lock);
+	atomic_set(&cq->nr_pending_entries, 0);
 	mutex_init(&cq->irq_lock);
 
 	/* TODO Physically non-contiguous prp list */
@@ -81,6 +97,7 @@ static void __nvmev_admin_create_cq(int eid)
 
 	dbs_idx = cq->qid * 2 + 1;
 	nvmev_vdev->dbs[dbs_idx] = nvmev_vdev->old_dbs[dbs_idx] = 0;
+	__reset_dbbuf(dbs_idx);
 
 	__make_cq_entry(eid, NVME_SC_SUCCESS);
 }
@@ -94,9 +111,10 @@ static void __nvmev_admin_delete_cq(int eid)
 	qid = sq_entry(eid).delete_queue.qid;
 
 	cq = nvmev_vdev->cqes[qid];
-	nvmev_vdev->cqes[qid] = NULL;
+	WRITE_ONCE(nvmev_vdev->cqes[qid], NULL);
 
 	if (cq) {
+		nvmev_quiesce_dispatchers();
 		kfree(cq->cq);
 		kfree(cq);
 	}
@@ -135,6 +153,7 @@ static void __nvmev_admin_create_sq(int eid)
 	dbs_idx = sq->qid * 2;
 	nvmev_vdev->dbs[dbs_idx] = 0;
 	nvmev_vdev->old_dbs[dbs_idx] = 0;
+	__reset_dbbuf(dbs_idx);
 
 	__make_cq_entry(eid, NVME_SC_SUCCESS);
 }
@@ -149,9 +168,10 @@ static void __nvmev_admin_delete_sq(int eid)
 	qid = cmd->qid;
 
 	sq = nvmev_vdev->sqes[qid];
-	nvmev_vdev->sqes[qid] = NULL;
+	WRITE_ONCE(nvmev_vdev->sqes[qid], NULL);
 
 	if (sq) {
+		nvmev_quiesce_dispatchers();
 		kfree(sq->sq);
 		kfree(sq);
 	}
@@ -159,6 +179,46 @@ static void __nvmev_admin_delete_sq(int eid)
 	__make_cq_entry(eid, NVME_SC_SUCCESS);
 }
 
+/*
+ * Doorbell Buffer Config: the host publishes the I/O queue doorbells to
+ * @prp1 and only rings the BAR doorbell when it passes the EventIdx in @prp2.
+ * The dispatcher polls the shadow doorbells and keeps the EventIdx right
+ * behind the consumed value, so the host does not need to ring at all.
+ */
+static void __nvmev_admin_dbbuf(int eid)
+{
+	struct nvmev_admin_queue *queue = nvmev_vdev->admin_q;
+	struct nvme_common_command *cmd = &sq_entry(eid).common;
+	u32 *dbbuf_dbs, *dbbuf_eis;
+	int qid;
+
+	if (!cmd->prp1 || !cmd->prp2 || (cmd->prp1 & ~PAGE_MASK) || (cmd->prp2 & ~PAGE_MASK)) {
+		__make_cq_entry(eid, NVME_SC_INVALID_FIELD);
+		return;
+	}
+
+	dbbuf_dbs = prp_address(cmd->prp1);
+	dbbuf_eis = prp_address(cmd->prp2);
+
+	/* Seed the buffers with the doorbells of the queues already created */
+	for (qid = 1; qid <= NR_MAX_IO_QUEUE; qid++) {
+		if (nvmev_vdev->sqes[qid]) {
+			dbbuf_dbs[qid * 2] = nvmev_vdev->dbs[qid * 2];
+			dbbuf_eis[qid * 2] = nvmev_vdev->dbs[qid * 2] - 1;
+		}
+		if (nvmev_vdev->cqes[qid]) {
+			dbbuf_dbs[qid * 2 + 1] = nvmev_vdev->dbs[qid * 2 + 1];
+			dbbuf_eis[qid * 2 + 1] = nvmev_vdev->dbs[qid * 2 + 1] - 1;
+		}
+	}
+
+	WRITE_ONCE(nvmev_vdev->dbbuf_eis, dbbuf_eis);
+	smp_wmb();
+	WRITE_ONCE(nvmev_vdev->dbbuf_dbs, dbbuf_dbs);
+
+	__make_cq_entry(eid, NVME_SC_SUCCESS);
+}
+
 /***
  * Log pages
  */
@@ -196,6 +256,7 @@ static void __nvmev_admin_get_log_page(int eid)
 					[nvme_admin_set_features] = cpu_to_le32(NVME_CMD_EFFECTS_CSUPP),
 					[nvme_admin_get_features] = cpu_to_le32(NVME_CMD_EFFECTS_CSUPP),
 					[nvme_admin_async_event] = cpu_to_le32(NVME_CMD_EFFECTS_CSUPP),
+					[nvme_admin_dbbuf] = cpu_to_le32(NVME_CMD_EFFECTS_CSUPP),
 					// [nvme_admin_keep_alive] = cpu_to_le32(NVME_CMD_EFFECTS_CSUPP),
 				},
 			.iocs =
@@ -410,6 +471,7 @@ static void __nvmev_admin_identify_ctrl(int eid)
 
 	ctrl->nn = nvmev_vdev->nr_ns;
 	ctrl->oncs = 0; // optional command
+	ctrl->oacs = cpu_to_le16(NVME_CTRL_OACS_DBBUF_SUPP);
 	ctrl->acl = 3;	// minimum 4 required, 0's based value
 	//[MISAO] The device supports host-issued FUA or flush commands only when this variable is set
 	//to 1.
@@ -486,7 +548,22 @@ static void __nvmev_admin_set_features(int eid)
 		result0 = ((nvmev_vdev->nr_cq - 1) << 16 | (nvmev_vdev->nr_sq - 1));
 		break;
 	}
-	case NVME_FEAT_IRQ_COALESCE:
+	case NVME_FEAT_IRQ_COALESCE: {
+		int qid;
+
+		// aggregation threshold in 0-base, aggregation time in 100 usec
+		nvmev_vdev->irq_coalesce_thr = sq_entry(eid).features.dword11 & 0xFF;
+		nvmev_vdev->irq_coalesce_time = (sq_entry(eid).features.dword11 >> 8) & 0xFF;
+
+		for (qid = 1; qid <= NR_MAX_IO_QUEUE; qid++) {
+			struct nvmev_completion_queue *cq = nvmev_vdev->cqes[qid];
+
+			if (cq == NULL)
+				continue;
+			__set_cq_irq_coalesce(cq);
+		}
+		break;
+	}
 	case NVME_FEAT_IRQ_CONFIG:
 	case NVME_FEAT_WRITE_ATOMIC:
 	case NVME_FEAT_ASYNC_EVENT:
@@ -521,6 +598,8 @@ static void __nvmev_admin_get_features(int eid)
 		result0 = ((nvmev_vdev->nr_cq - 1) << 16 | (nvmev_vdev->nr_sq - 1));
 		break;
 	case NVME_FEAT_IRQ_COALESCE:
+		result0 = (nvmev_vdev->irq_coalesce_time << 8 | nvmev_vdev->irq_coalesce_thr);
+		break;
 	case NVME_FEAT_IRQ_CONFIG:
 	case NVME_FEAT_WRITE_ATOMIC:
 	case NVME_FEAT_ASYNC_EVENT:
@@ -583,6 +662,9 @@ static void __nvmev_proc_admin_req(int entry_id)
 	case nvme_admin_async_event:
 		__nvmev_admin_async_event(entry_id);
 		break;
+	case nvme_admin_dbbuf:
+		__nvmev_admin_dbbuf(entry_id);
+		break;
 	case nvme_admin_activate_fw:
 	case nvme_admin_download_fw:
 	case nvme_admin_format_nvm:
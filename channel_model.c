@@ -13,6 +13,22 @@ static inline unsigned long long __get_wallclock(void)
 	return cpu_clock(nvmev_vdev->config.cpu_nr_dispatcher);
 }
 
+/* Number of leading entries of @credits equal to @value, at most @len */
+static inline uint32_t __chmodel_run_len(credit_t *credits, credit_t value, uint32_t len)
+{
+#if (SIZE_OF_CREDIT_T == 1)
+	credit_t *end = memchr_inv(credits, value, len);
+
+	return end ? end - credits : len;
+#else
+	uint32_t i;
+
+	for (i = 0; i < len && credits[i] == value; i++)
+		;
+	return i;
+#endif
+}
+
 void chmodel_init(struct channel_model *ch, uint64_t bandwidth /*MB/s*/)
 {
 	ch->head = 0;
@@ -83,10 +99,27 @@ uint64_t chmodel_request(struct channel_model *ch, uint64_t request_time, uint64
 	delay = 0;
 
 	while (1) {
-		consumed_credits = (remaining_credits <= ch->avail_credits[pos]) ? remaining_credits
-																		 : ch->avail_credits[pos];
-		ch->avail_credits[pos] -= consumed_credits;
-		remaining_credits -= consumed_credits;
+		credit_t credits = ch->avail_credits[pos];
+		uint32_t nr_slots = 1;
+		/* slots that can be taken in one go: up to the array end or the head */
+		uint32_t max_slots = (ch->head > pos) ? (ch->head - pos) : (NR_CREDIT_ENTRIES - pos);
+
+		if (remaining_credits >= ch->max_credits && credits == ch->max_credits) {
+			/* Untouched slots are fully consumed at once */
+			nr_slots = __chmodel_run_len(&ch->avail_credits[pos], ch->max_credits,
+										 min(max_slots, remaining_credits / ch->max_credits));
+			MEMSET(&(ch->avail_credits[pos]), 0, nr_slots);
+			remaining_credits -= nr_slots * ch->max_credits;
+		} else if (remaining_credits && credits == 0) {
+			/* Exhausted slots are skipped at once */
+			nr_slots = __chmodel_run_len(&ch->avail_credits[pos], 0, max_slots);
+		} else {
+			consumed_credits = (remaining_credits <= credits) ? remaining_credits : credits;
+			ch->avail_credits[pos] -= consumed_credits;
+			remaining_credits -= consumed_credits;
+		}
+		pos += nr_slots - 1;
+		delay += nr_slots - 1;
 
 		if (remaining_credits) {
 			next_pos = (pos + 1) % NR_CREDIT_ENTRIES;
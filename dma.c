@@ -179,6 +179,63 @@ out:
 	return ret;
 }
 
+/*
+ * Asynchronous submission. Descriptors are only issued to the engine by
+ * ioat_dma_issue_pending(); since the channel completes them in order,
+ * polling the cookie of the last copy of a request covers all of it.
+ */
+static DEFINE_SPINLOCK(submit_lock);
+
+bool ioat_dma_async_capable(void)
+{
+	struct dma_chan *chan = dma_thread.chan;
+
+	return chan && !dma_has_cap(DMA_COMPLETION_NO_ORDER, chan->device->cap_mask);
+}
+
+int ioat_dma_submit_async(dma_addr_t src_addr, dma_addr_t dst_addr, unsigned int size,
+			  dma_cookie_t *cookie)
+{
+	struct dma_chan *chan = dma_thread.chan;
+	struct dma_async_tx_descriptor *tx;
+	int ret = 0;
+
+	spin_lock(&submit_lock);
+	tx = chan->device->device_prep_dma_memcpy(chan, dst_addr, src_addr, size, DMA_CTRL_ACK);
+	if (!tx) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	*cookie = tx->tx_submit(tx);
+	if (dma_submit_error(*cookie))
+		ret = -EIO;
+out:
+	spin_unlock(&submit_lock);
+
+	if (ret)
+		result(ret == -ENOMEM ? "prep error" : "submit error", 1, src_addr, dst_addr, size,
+		       ret);
+	return ret;
+}
+
+void ioat_dma_issue_pending(void)
+{
+	dma_async_issue_pending(dma_thread.chan);
+}
+
+/* Returns 0 once @cookie is done, -EINPROGRESS while in flight, -EIO on error */
+int ioat_dma_poll(dma_cookie_t cookie)
+{
+	enum dma_status status = dma_async_is_tx_complete(dma_thread.chan, cookie, NULL, NULL);
+
+	if (status == DMA_COMPLETE)
+		return 0;
+	if (status == DMA_ERROR)
+		return -EIO;
+	return -EINPROGRESS;
+}
+
 static int ioat_dma_add_channel(struct ioat_dma_info *info, struct dma_chan *chan)
 {
 	struct ioat_dma_chan *dtc;
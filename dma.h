@@ -3,9 +3,18 @@
 #ifndef _LIB_DMA_H
 #define _LIB_DMA_H
 
+#include <linux/dmaengine.h>
+
 // DMA Init, Final Function
 int ioat_dma_chan_set(const char *val);
 int ioat_dma_submit(dma_addr_t src_addr, dma_addr_t dst_addr, unsigned int size);
 void ioat_dma_cleanup(void);
 
+// Asynchronous submission, completion is polled by cookie
+bool ioat_dma_async_capable(void);
+int ioat_dma_submit_async(dma_addr_t src_addr, dma_addr_t dst_addr, unsigned int size,
+			  dma_cookie_t *cookie);
+void ioat_dma_issue_pending(void);
+int ioat_dma_poll(dma_cookie_t cookie);
+
 #endif /* _LIB_DMA_H */
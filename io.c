@@ -5,6 +5,7 @@
 #include <linux/ktime.h>
 #include <linux/highmem.h>
 #include <linux/sched/clock.h>
+#include <linux/math64.h>
 
 #include "nvmev.h"
 #include "dma.h"
@@ -22,7 +23,7 @@ struct buffer;
 #define sq_entry(entry_id) sq->sq[SQ_ENTRY_TO_PAGE_NUM(entry_id)][SQ_ENTRY_TO_PAGE_OFFSET(entry_id)]
 #define cq_entry(entry_id) cq->cq[CQ_ENTRY_TO_PAGE_NUM(entry_id)][CQ_ENTRY_TO_PAGE_OFFSET(entry_id)]
 
-extern bool io_using_dma;
+extern int io_using_dma;
 
 static inline unsigned int __get_io_worker(int sqid)
 {
@@ -48,6 +49,21 @@ static inline size_t __cmd_io_size(struct nvme_rw_command *cmd)
 	return (cmd->length + 1) << LBA_BITS;
 }
 
+static inline void __do_perform_io_run(struct nvme_rw_command *cmd, void *mapped, u64 paddr,
+									   size_t io_size)
+{
+	void *vaddr = kmap_atomic_pfn(PRP_PFN(paddr));
+	size_t mem_offs = paddr & PAGE_OFFSET_MASK;
+
+	if (cmd->opcode == nvme_cmd_write || cmd->opcode == nvme_cmd_zone_append) {
+		memcpy(mapped, vaddr + mem_offs, io_size);
+	} else if (cmd->opcode == nvme_cmd_read) {
+		memcpy(vaddr + mem_offs, mapped, io_size);
+	}
+
+	kunmap_atomic(vaddr);
+}
+
 static unsigned int __do_perform_io(int sqid, int sq_entry)
 {
 	struct nvmev_submission_queue *sq = nvmev_vdev->sqes[sqid];
@@ -59,6 +75,8 @@ static unsigned int __do_perform_io(int sqid, int sq_entry)
 	u64 paddr;
 	u64 *paddr_list = NULL;
 	size_t nsid = cmd->nsid - 1; // 0-based
+	u64 run_paddr = 0;
+	size_t run_offset = 0, run_size = 0;
 
 	offset = __cmd_io_offset(cmd);
 	length = __cmd_io_size(cmd);
@@ -66,7 +84,6 @@ static unsigned int __do_perform_io(int sqid, int sq_entry)
 
 	while (remaining) {
 		size_t io_size;
-		void *vaddr;
 		size_t mem_offs = 0;
 
 		prp_offs++;
@@ -82,8 +99,6 @@ static unsigned int __do_perform_io(int sqid, int sq_entry)
 			paddr = paddr_list[prp2_offs++];
 		}
 
-		vaddr = kmap_atomic_pfn(PRP_PFN(paddr));
-
 		io_size = min_t(size_t, remaining, PAGE_SIZE);
 
 		if (paddr & PAGE_OFFSET_MASK) {
@@ -92,30 +107,47 @@ static unsigned int __do_perform_io(int sqid, int sq_entry)
 				io_size = PAGE_SIZE - mem_offs;
 		}
 
-		if (cmd->opcode == nvme_cmd_write || cmd->opcode == nvme_cmd_zone_append) {
-			memcpy(nvmev_vdev->ns[nsid].mapped + offset, vaddr + mem_offs, io_size);
-		} else if (cmd->opcode == nvme_cmd_read) {
-			memcpy(vaddr + mem_offs, nvmev_vdev->ns[nsid].mapped + offset, io_size);
+#ifndef CONFIG_HIGHMEM
+		/*
+		 * Physically contiguous PRPs are contiguous in the direct map as well,
+		 * so merge them and copy the whole run with a single mapping.
+		 */
+		if (run_size && paddr == run_paddr + run_size) {
+			run_size += io_size;
+		} else
+#endif
+		{
+			if (run_size)
+				__do_perform_io_run(cmd, nvmev_vdev->ns[nsid].mapped + run_offset, run_paddr,
+									run_size);
+			run_paddr = paddr;
+			run_offset = offset;
+			run_size = io_size;
 		}
 
-		kunmap_atomic(vaddr);
-
 		remaining -= io_size;
 		offset += io_size;
 	}
 
+	if (run_size)
+		__do_perform_io_run(cmd, nvmev_vdev->ns[nsid].mapped + run_offset, run_paddr, run_size);
+
 	if (paddr_list != NULL)
 		kunmap_atomic(paddr_list);
 
 	return length;
 }
 
-static u64 paddr_list[513] = {
-	0,
-}; // Not using index 0 to make max index == num_prp
-static unsigned int __do_perform_io_using_dma(int sqid, int sq_entry)
+/*
+ * Copies are issued asynchronously when @cookie is given; it then holds the
+ * cookie of the last copy, which completes after all the others.
+ * Returns a negative errno if a copy cannot be submitted.
+ */
+static int __do_perform_io_using_dma(struct nvmev_io_worker *worker, int sqid, int sq_entry,
+									 dma_cookie_t *cookie)
 {
 	struct nvmev_submission_queue *sq = nvmev_vdev->sqes[sqid];
+	u64 *paddr_list = worker->paddr_list; // Not using index 0 to make max index == num_prp
 	struct nvme_rw_command *cmd = &sq_entry(sq_entry).rw;
 	size_t offset;
 	size_t length, remaining;
@@ -126,12 +158,14 @@ static unsigned int __do_perform_io_using_dma(int sqid, int sq_entry)
 	u64 *tmp_paddr_list = NULL;
 	size_t io_size;
 	size_t mem_offs = 0;
+	dma_addr_t src, dst;
+	int ret = 0;
 
 	offset = __cmd_io_offset(cmd);
 	length = __cmd_io_size(cmd);
 	remaining = length;
 
-	memset(paddr_list, 0, sizeof(paddr_list));
+	memset(paddr_list, 0, sizeof(*paddr_list) * NR_DMA_PRP_LIST);
 	/* Loop to get the PRP list */
 	while (remaining) {
 		io_size = 0;
@@ -197,16 +231,66 @@ static unsigned int __do_perform_io_using_dma(int sqid, int sq_entry)
 		io_size = min_t(size_t, remaining, page_size);
 
 		if (cmd->opcode == nvme_cmd_write || cmd->opcode == nvme_cmd_zone_append) {
-			ioat_dma_submit(paddr, nvmev_vdev->config.storage_start + offset, io_size);
+			src = paddr;
+			dst = nvmev_vdev->config.storage_start + offset;
 		} else if (cmd->opcode == nvme_cmd_read) {
-			ioat_dma_submit(nvmev_vdev->config.storage_start + offset, paddr, io_size);
+			src = nvmev_vdev->config.storage_start + offset;
+			dst = paddr;
+		} else {
+			break;
 		}
 
+		if (cookie)
+			ret = ioat_dma_submit_async(src, dst, io_size, cookie);
+		else
+			ret = ioat_dma_submit(src, dst, io_size);
+		if (ret)
+			break;
+
 		remaining -= io_size;
 		offset += io_size;
 	}
 
-	return length;
+	if (cookie && remaining != length)
+		ioat_dma_issue_pending();
+
+	return ret;
+}
+
+/*
+ * Returns true once the data of @w is in place. DMA copies are left in
+ * flight so that the worker can go on with other requests meanwhile.
+ * Falls back to memcpy when the copies cannot be submitted or fail.
+ */
+static bool __do_perform_io_using_dma_async(struct nvmev_io_worker *worker,
+											struct nvmev_io_work *w)
+{
+	int ret;
+
+	if (!ioat_dma_async_capable()) {
+		if (__do_perform_io_using_dma(worker, w->sqid, w->sq_entry, NULL))
+			__do_perform_io(w->sqid, w->sq_entry);
+		return true;
+	}
+
+	if (!w->is_dma_issued) {
+		w->dma_cookie = 0;
+		if (__do_perform_io_using_dma(worker, w->sqid, w->sq_entry, &w->dma_cookie)) {
+			__do_perform_io(w->sqid, w->sq_entry);
+			return true;
+		}
+		w->is_dma_issued = true;
+		if (w->dma_cookie == 0) /* Nothing to copy */
+			return true;
+	}
+
+	ret = ioat_dma_poll(w->dma_cookie);
+	if (ret == -EINPROGRESS)
+		return false;
+	if (ret)
+		__do_perform_io(w->sqid, w->sq_entry);
+
+	return true;
 }
 
 static void __insert_req_sorted(unsigned int entry, struct nvmev_io_worker *worker,
@@ -218,51 +302,66 @@ static void __insert_req_sorted(unsigned int entry, struct nvmev_io_worker *work
 	 * implemented by chaining the indexes of entries with @prev and @next.
 	 * This implementation is nasty but we do this way over dynamically
 	 * allocated linked list to minimize the influence of dynamic memory allocation.
-	 * Also, this O(n) implementation can be improved to O(logn) scheme with
-	 * e.g., red-black tree but....
+	 * The io worker walks the @prev/@next chain, while the insertion point is
+	 * looked up in O(logn) with @work_tree, a red-black tree indexing the same
+	 * entries. Requests never go before one that is already due (@latest_nsecs),
+	 * and requests with the same key are kept in FIFO order.
 	 */
-	if (worker->io_seq == -1) {
-		worker->io_seq = entry;
-		worker->io_seq_end = entry;
-	} else {
-		unsigned int curr = worker->io_seq_end;
+	struct nvmev_io_work *w = &worker->work_queue[entry];
+	struct rb_node **link = &worker->work_tree.rb_node;
+	struct rb_node *parent = NULL;
+	unsigned int curr = -1;
 
-		while (curr != -1) {
-			if (worker->work_queue[curr].nsecs_target <= worker->latest_nsecs)
-				break;
+	w->nsecs_key = max_t(unsigned long long, nsecs_target, worker->latest_nsecs);
 
-			if (worker->work_queue[curr].nsecs_target <= nsecs_target)
-				break;
+	while (*link) {
+		struct nvmev_io_work *node = rb_entry(*link, struct nvmev_io_work, rb);
 
-			curr = worker->work_queue[curr].prev;
+		parent = *link;
+		if (w->nsecs_key < node->nsecs_key) {
+			link = &parent->rb_left;
+		} else {
+			curr = node - worker->work_queue;
+			link = &parent->rb_right;
 		}
+	}
+	rb_link_node(&w->rb, parent, link);
+	rb_insert_color(&w->rb, &worker->work_tree);
 
-		if (curr == -1) { /* Head inserted */
-			worker->work_queue[worker->io_seq].prev = entry;
-			worker->work_queue[entry].next = worker->io_seq;
-			worker->io_seq = entry;
-		} else if (worker->work_queue[curr].next == -1) { /* Tail */
-			worker->work_queue[entry].prev = curr;
-			worker->io_seq_end = entry;
-			worker->work_queue[curr].next = entry;
-		} else { /* In between */
-			worker->work_queue[entry].prev = curr;
-			worker->work_queue[entry].next = worker->work_queue[curr].next;
-
-			worker->work_queue[worker->work_queue[entry].next].prev = entry;
-			worker->work_queue[curr].next = entry;
-		}
+	if (worker->io_seq == -1) {
+		worker->io_seq = entry;
+		worker->io_seq_end = entry;
+	} else if (curr == -1) { /* Head inserted */
+		worker->work_queue[worker->io_seq].prev = entry;
+		w->next = worker->io_seq;
+		worker->io_seq = entry;
+	} else if (worker->work_queue[curr].next == -1) { /* Tail */
+		w->prev = curr;
+		worker->io_seq_end = entry;
+		worker->work_queue[curr].next = entry;
+	} else { /* In between */
+		w->prev = curr;
+		w->next = worker->work_queue[curr].next;
+
+		worker->work_queue[w->next].prev = entry;
+		worker->work_queue[curr].next = entry;
 	}
 }
 
+/* Returns the worker with @lock held; release it once the entry is inserted */
 static struct nvmev_io_worker *__allocate_work_queue_entry(int sqid, unsigned int *entry)
 {
 	unsigned int io_worker_turn = __get_io_worker(sqid);
 	struct nvmev_io_worker *worker = &nvmev_vdev->io_workers[io_worker_turn];
-	unsigned int e = worker->free_seq;
-	struct nvmev_io_work *w = worker->work_queue + e;
+	unsigned int e;
+	struct nvmev_io_work *w;
+
+	spin_lock(&worker->lock);
+	e = worker->free_seq;
+	w = worker->work_queue + e;
 
 	if (w->next >= NR_MAX_PARALLEL_IO) {
+		spin_unlock(&worker->lock);
 		WARN_ON_ONCE("IO queue is almost full");
 		return NULL;
 	}
@@ -307,6 +406,7 @@ static void __enqueue_io_req(int sqid, int cqid, int sq_entry, unsigned long lon
 	w->status = ret->status;
 	w->is_completed = false;
 	w->is_copied = false;
+	w->is_dma_issued = false;
 	w->prev = -1;
 	w->next = -1;
 
@@ -314,6 +414,7 @@ static void __enqueue_io_req(int sqid, int cqid, int sq_entry, unsigned long lon
 	mb(); /* IO worker shall see the updated w at once */
 
 	__insert_req_sorted(entry, worker, ret->nsecs_target);
+	spin_unlock(&worker->lock);
 
 	// trace_printk("[i] curr %u start: %llu , target: %llu target lat %llu us\n", entry, w->nsecs_start, w->nsecs_target, (w->nsecs_target - w->nsecs_start) / 1000);
 
@@ -351,6 +452,7 @@ void schedule_internal_operation(int sqid, unsigned long long nsecs_target,
 	mb(); /* IO worker shall see the updated w at once */
 
 	__insert_req_sorted(entry, worker, nsecs_target);
+	spin_unlock(&worker->lock);
 
 	// trace_printk("[i] curr %u buffer ns type %d start: %llu , target: %llu target lat %llu us\n", entry, write_buffer->ns_type, w->nsecs_start, w->nsecs_target, (w->nsecs_target - w->nsecs_start) / 1000);
 
@@ -372,6 +474,10 @@ static void __reclaim_completed_reqs(void)
 
 		worker = &nvmev_vdev->io_workers[turn];
 
+		/* Another dispatcher is working on this queue; leave it to that one */
+		if (!spin_trylock(&worker->lock))
+			continue;
+
 		first_entry = worker->io_seq;
 		curr = first_entry;
 
@@ -379,6 +485,7 @@ static void __reclaim_completed_reqs(void)
 			w = &worker->work_queue[curr];
 			if (w->is_completed == true && w->is_copied == true &&
 				w->nsecs_target <= worker->latest_nsecs) {
+				rb_erase(&w->rb, &worker->work_tree);
 				last_entry = curr;
 				curr = w->next;
 				nr_reclaimed++;
@@ -405,6 +512,7 @@ static void __reclaim_completed_reqs(void)
 			NVMEV_DEBUG_VERBOSE("%s: %u -- %u, %d\n", __func__, first_entry, last_entry,
 								nr_reclaimed);
 		}
+		spin_unlock(&worker->lock);
 	}
 }
 
@@ -429,6 +537,7 @@ static size_t __nvmev_proc_io(int sqid, int sq_entry, size_t *io_size)
 		.nsecs_target = nsecs_start,
 		.status = NVME_SC_SUCCESS,
 	};
+	bool handled;
 
 #ifdef PERF_DEBUG
 	unsigned long long prev_clock = local_clock();
@@ -441,7 +550,10 @@ static size_t __nvmev_proc_io(int sqid, int sq_entry, size_t *io_size)
 	static unsigned long long counter = 0;
 #endif
 
-	if (!ns->proc_io_cmd(ns, &req, &ret))
+	mutex_lock(ns->ftl_lock);
+	handled = ns->proc_io_cmd(ns, &req, &ret);
+	mutex_unlock(ns->ftl_lock);
+	if (!handled)
 		return false;
 	*io_size = __cmd_io_size(&sq_entry(sq_entry).rw);
 
@@ -533,6 +645,12 @@ void nvmev_proc_io_cq(int cqid, int new_db, int old_db)
 		cq->cq_tail = cq->queue_size - 1;
 }
 
+/*
+ * Workers completing into the same CQ do not serialize: each one reserves
+ * a slot, fills it and publishes it by writing the status (with the phase
+ * tag) last. The host consumes entries in order, so a slot published ahead
+ * of a preceding one is only seen once that one is published as well.
+ */
 static void __fill_cq_result(struct nvmev_io_work *w)
 {
 	int sqid = w->sqid;
@@ -544,25 +662,39 @@ static void __fill_cq_result(struct nvmev_io_work *w)
 	unsigned int result1 = w->result1;
 
 	struct nvmev_completion_queue *cq = nvmev_vdev->cqes[cqid];
-	int cq_head = cq->cq_head;
+	u64 seq = atomic64_inc_return(&cq->nr_reserved) - 1;
+	u32 cq_head;
+	int phase = !(div_u64_rem(seq, cq->queue_size, &cq_head) & 1);
 	struct nvme_completion *cqe = &cq_entry(cq_head);
 
-	spin_lock(&cq->entry_lock);
 	cqe->command_id = command_id;
 	cqe->sq_id = sqid;
 	cqe->sq_head = sq_entry;
-	cqe->status = cq->phase | (status << 1);
 	cqe->result0 = result0;
 	cqe->result1 = result1;
+	smp_wmb(); /* The host shall see the entry before its phase tag */
+	WRITE_ONCE(cqe->status, phase | (status << 1));
 
-	if (++cq_head == cq->queue_size) {
-		cq_head = 0;
-		cq->phase = !cq->phase;
-	}
-
-	cq->cq_head = cq_head;
+	if (atomic_inc_return(&cq->nr_pending_entries) == 1)
+		cq->nsecs_first_pending = local_clock();
+	smp_wmb();
 	cq->interrupt_ready = true;
-	spin_unlock(&cq->entry_lock);
+}
+
+/*
+ * Holds off the interrupt until either the aggregation threshold or the
+ * aggregation time set by NVME_FEAT_IRQ_COALESCE is reached.
+ * Called with @irq_lock held.
+ */
+static bool __test_and_clear_irq_ready(struct nvmev_completion_queue *cq)
+{
+	if (atomic_read(&cq->nr_pending_entries) <= cq->irq_coalesce_thr &&
+		local_clock() - cq->nsecs_first_pending < cq->irq_coalesce_nsecs)
+		return false;
+
+	cq->interrupt_ready = false;
+	atomic_set(&cq->nr_pending_entries, 0);
+	return true;
 }
 
 static int nvmev_io_worker(void *data)
@@ -606,7 +738,10 @@ static int nvmev_io_worker(void *data)
 				if (w->is_internal) {
 					;
 				} else if (io_using_dma) {
-					__do_perform_io_using_dma(w->sqid, w->sq_entry);
+					if (!__do_perform_io_using_dma_async(worker, w)) {
+						curr = w->next;
+						continue;
+					}
 				} else {
 #if (BASE_SSD == KV_PROTOTYPE)
 					struct nvmev_submission_queue *sq = nvmev_vdev->sqes[w->sqid];
@@ -683,11 +818,10 @@ static int nvmev_io_worker(void *data)
 				continue;
 
 			if (mutex_trylock(&cq->irq_lock)) {
-				if (cq->interrupt_ready == true) {
+				if (cq->interrupt_ready == true && __test_and_clear_irq_ready(cq)) {
 #ifdef PERF_DEBUG
 					prev_clock = local_clock();
 #endif
-					cq->interrupt_ready = false;
 					nvmev_signal_irq(cq->irq_vector);
 
 #ifdef PERF_DEBUG
@@ -736,6 +870,9 @@ void NVMEV_IO_WORKER_INIT(struct nvmev_dev *nvmev_vdev)
 		worker->free_seq_end = NR_MAX_PARALLEL_IO - 1;
 		worker->io_seq = -1;
 		worker->io_seq_end = -1;
+		worker->work_tree = RB_ROOT;
+		spin_lock_init(&worker->lock);
+		worker->paddr_list = kcalloc(NR_DMA_PRP_LIST, sizeof(u64), GFP_KERNEL);
 
 		snprintf(worker->thread_name, sizeof(worker->thread_name), "nvmev_io_worker_%d", worker_id);
 
@@ -758,6 +895,7 @@ void NVMEV_IO_WORKER_FINAL(struct nvmev_dev *nvmev_vdev)
 		}
 
 		kfree(worker->work_queue);
+		kfree(worker->paddr_list);
 	}
 
 	kfree(nvmev_vdev->io_workers);
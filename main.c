@@ -71,8 +71,16 @@ static unsigned int nr_io_units = 8;
 static unsigned int io_unit_shift = 12;
 
 static char *cpus;
+static unsigned int nr_dispatchers = 1;
 static unsigned int debug = 0;
 
+#if (BASE_SSD == CONZONE_PROTOTYPE)
+static unsigned long l2p_cache_size = L2P_CACHE_SIZE;
+static unsigned int l2p_cache_slots = L2P_CACHE_HASH_SLOT;
+static unsigned int l2p_evict_policy = L2P_EVICT_POLICY;
+static unsigned int gc_victim_policy = GC_VICTIM_POLICY;
+#endif
+
 int io_using_dma = false;
 
 static int set_parse_mem_param(const char *val, const struct kernel_param *kp)
@@ -109,11 +117,52 @@ module_param(io_unit_shift, uint, 0444);
 MODULE_PARM_DESC(io_unit_shift, "Size of each I/O unit (2^)");
 module_param(cpus, charp, 0444);
 MODULE_PARM_DESC(cpus, "CPU list for process, completion(int.) threads, Seperated by Comma(,)");
+module_param(nr_dispatchers, uint, 0444);
+MODULE_PARM_DESC(nr_dispatchers, "Number of leading CPUs in cpus used as dispatchers");
 module_param(debug, uint, 0644);
+#if (BASE_SSD == CONZONE_PROTOTYPE)
+module_param_cb(l2p_cache_size, &ops_parse_mem_param, &l2p_cache_size, 0444);
+MODULE_PARM_DESC(l2p_cache_size, "L2P cache size in bytes");
+module_param(l2p_cache_slots, uint, 0444);
+MODULE_PARM_DESC(l2p_cache_slots, "Number of L2P cache hash slots");
+module_param(l2p_evict_policy, uint, 0444);
+MODULE_PARM_DESC(l2p_evict_policy, "L2P cache eviction policy (0: none, 1: LRU, 2: 2Q, 3: CLOCK)");
+module_param(gc_victim_policy, uint, 0444);
+MODULE_PARM_DESC(gc_victim_policy, "GC victim policy (0: greedy, 1: cost-benefit, 2: windowed greedy)");
+#endif
+
+/* I/O queue doorbells come from the shadow buffer once the host has set one */
+static inline u32 __get_io_db(int dbs_idx)
+{
+	u32 *dbbuf_dbs = READ_ONCE(nvmev_vdev->dbbuf_dbs);
+
+	if (dbbuf_dbs) {
+		smp_rmb();
+		return READ_ONCE(dbbuf_dbs[dbs_idx]);
+	}
+	return nvmev_vdev->dbs[dbs_idx];
+}
+
+/*
+ * The host rings the BAR doorbell only when its update passes the EventIdx.
+ * We poll anyway, so keep it right behind the consumed value.
+ */
+static inline void __set_io_eventidx(int dbs_idx)
+{
+	u32 *dbbuf_eis = READ_ONCE(nvmev_vdev->dbbuf_eis);
+
+	if (dbbuf_eis && READ_ONCE(nvmev_vdev->dbbuf_dbs))
+		WRITE_ONCE(dbbuf_eis[dbs_idx], nvmev_vdev->old_dbs[dbs_idx] - 1);
+}
 
-// Returns true if an event is processed
-static bool nvmev_proc_dbs(void)
+/*
+ * Returns true if an event is processed.
+ * I/O queues are sharded by qid over the dispatchers; dispatcher 0 also
+ * owns the admin queue.
+ */
+static bool nvmev_proc_dbs(unsigned int id)
 {
+	const unsigned int nr_dispatchers = nvmev_vdev->config.nr_dispatchers;
 	int qid;
 	int dbs_idx;
 	int new_db;
@@ -121,61 +170,84 @@ static bool nvmev_proc_dbs(void)
 	bool updated = false;
 
 	// Admin queue
-	new_db = nvmev_vdev->dbs[0];
-	if (new_db != nvmev_vdev->old_dbs[0]) {
-		nvmev_proc_admin_sq(new_db, nvmev_vdev->old_dbs[0]);
-		nvmev_vdev->old_dbs[0] = new_db;
-		updated = true;
-	}
-	new_db = nvmev_vdev->dbs[1];
-	if (new_db != nvmev_vdev->old_dbs[1]) {
-		nvmev_proc_admin_cq(new_db, nvmev_vdev->old_dbs[1]);
-		nvmev_vdev->old_dbs[1] = new_db;
-		updated = true;
+	if (id == 0) {
+		new_db = nvmev_vdev->dbs[0];
+		if (new_db != nvmev_vdev->old_dbs[0]) {
+			nvmev_proc_admin_sq(new_db, nvmev_vdev->old_dbs[0]);
+			nvmev_vdev->old_dbs[0] = new_db;
+			updated = true;
+		}
+		new_db = nvmev_vdev->dbs[1];
+		if (new_db != nvmev_vdev->old_dbs[1]) {
+			nvmev_proc_admin_cq(new_db, nvmev_vdev->old_dbs[1]);
+			nvmev_vdev->old_dbs[1] = new_db;
+			updated = true;
+		}
 	}
 
+	mutex_lock(&nvmev_vdev->dispatcher_lock[id]);
+
 	// Submission queues
-	for (qid = 1; qid <= nvmev_vdev->nr_sq; qid++) {
-		if (nvmev_vdev->sqes[qid] == NULL)
+	for (qid = 1 + id; qid <= nvmev_vdev->nr_sq; qid += nr_dispatchers) {
+		if (READ_ONCE(nvmev_vdev->sqes[qid]) == NULL)
 			continue;
 		dbs_idx = qid * 2;
-		new_db = nvmev_vdev->dbs[dbs_idx];
+		new_db = __get_io_db(dbs_idx);
 		old_db = nvmev_vdev->old_dbs[dbs_idx];
 		if (new_db != old_db) {
 			nvmev_vdev->old_dbs[dbs_idx] = nvmev_proc_io_sq(qid, new_db, old_db);
+			__set_io_eventidx(dbs_idx);
 			updated = true;
 		}
 	}
 
 	// Completion queues
-	for (qid = 1; qid <= nvmev_vdev->nr_cq; qid++) {
-		if (nvmev_vdev->cqes[qid] == NULL)
+	for (qid = 1 + id; qid <= nvmev_vdev->nr_cq; qid += nr_dispatchers) {
+		if (READ_ONCE(nvmev_vdev->cqes[qid]) == NULL)
 			continue;
 		dbs_idx = qid * 2 + 1;
-		new_db = nvmev_vdev->dbs[dbs_idx];
+		new_db = __get_io_db(dbs_idx);
 		old_db = nvmev_vdev->old_dbs[dbs_idx];
 		if (new_db != old_db) {
 			nvmev_proc_io_cq(qid, new_db, old_db);
 			nvmev_vdev->old_dbs[dbs_idx] = new_db;
+			__set_io_eventidx(dbs_idx);
 			updated = true;
 		}
 	}
 
+	mutex_unlock(&nvmev_vdev->dispatcher_lock[id]);
+
 	return updated;
 }
 
+/*
+ * Waits until no dispatcher is inside an I/O queue pass started before the
+ * call. Queues unpublished from sqes/cqes beforehand can then be freed.
+ */
+void nvmev_quiesce_dispatchers(void)
+{
+	unsigned int id;
+
+	for (id = 0; id < nvmev_vdev->config.nr_dispatchers; id++) {
+		mutex_lock(&nvmev_vdev->dispatcher_lock[id]);
+		mutex_unlock(&nvmev_vdev->dispatcher_lock[id]);
+	}
+}
+
 static int nvmev_dispatcher(void *data)
 {
-	static unsigned long last_dispatched_time = 0;
+	unsigned int id = (unsigned int)(unsigned long)data;
+	unsigned int cpu_nr = nvmev_vdev->config.cpu_nr_dispatchers[id];
+	unsigned long last_dispatched_time = 0;
 
-	NVMEV_INFO("nvmev_dispatcher started on cpu %d (node %d)\n",
-			   nvmev_vdev->config.cpu_nr_dispatcher,
-			   cpu_to_node(nvmev_vdev->config.cpu_nr_dispatcher));
+	NVMEV_INFO("nvmev_dispatcher_%u started on cpu %d (node %d)\n", id, cpu_nr,
+			   cpu_to_node(cpu_nr));
 
 	while (!kthread_should_stop()) {
-		if (nvmev_proc_bars())
+		if (id == 0 && nvmev_proc_bars())
 			last_dispatched_time = jiffies;
-		if (nvmev_proc_dbs())
+		if (nvmev_proc_dbs(id))
 			last_dispatched_time = jiffies;
 
 		if (CONFIG_NVMEVIRT_IDLE_TIMEOUT != 0 &&
@@ -190,17 +262,32 @@ static int nvmev_dispatcher(void *data)
 
 static void NVMEV_DISPATCHER_INIT(struct nvmev_dev *nvmev_vdev)
 {
-	nvmev_vdev->nvmev_dispatcher = kthread_create(nvmev_dispatcher, NULL, "nvmev_dispatcher");
-	if (nvmev_vdev->config.cpu_nr_dispatcher != -1)
-		kthread_bind(nvmev_vdev->nvmev_dispatcher, nvmev_vdev->config.cpu_nr_dispatcher);
-	wake_up_process(nvmev_vdev->nvmev_dispatcher);
+	unsigned int id;
+
+	for (id = 0; id < nvmev_vdev->config.nr_dispatchers; id++)
+		mutex_init(&nvmev_vdev->dispatcher_lock[id]);
+
+	for (id = 0; id < nvmev_vdev->config.nr_dispatchers; id++) {
+		struct task_struct *task = kthread_create(nvmev_dispatcher, (void *)(unsigned long)id,
+												  "nvmev_dispatcher_%u", id);
+		nvmev_vdev->nvmev_dispatcher[id] = task;
+		if (IS_ERR(task))
+			continue;
+		if (nvmev_vdev->config.cpu_nr_dispatchers[id] != -1)
+			kthread_bind(task, nvmev_vdev->config.cpu_nr_dispatchers[id]);
+		wake_up_process(task);
+	}
 }
 
 static void NVMEV_DISPATCHER_FINAL(struct nvmev_dev *nvmev_vdev)
 {
-	if (!IS_ERR_OR_NULL(nvmev_vdev->nvmev_dispatcher)) {
-		kthread_stop(nvmev_vdev->nvmev_dispatcher);
-		nvmev_vdev->nvmev_dispatcher = NULL;
+	unsigned int id;
+
+	for (id = 0; id < nvmev_vdev->config.nr_dispatchers; id++) {
+		if (!IS_ERR_OR_NULL(nvmev_vdev->nvmev_dispatcher[id])) {
+			kthread_stop(nvmev_vdev->nvmev_dispatcher[id]);
+			nvmev_vdev->nvmev_dispatcher[id] = NULL;
+		}
 	}
 }
 
@@ -267,6 +354,21 @@ static int __validate_configs(void)
 		return -EINVAL;
 	}
 
+#if (BASE_SSD == CONZONE_PROTOTYPE)
+	if (l2p_cache_slots == 0 || l2p_cache_size / L2P_ENTRY_SIZE < l2p_cache_slots) {
+		NVMEV_ERROR("L2P cache of %lu bytes cannot hold %u slots\n", l2p_cache_size, l2p_cache_slots);
+		return -EINVAL;
+	}
+	if (l2p_evict_policy > L2P_EVICTION_POLICY_CLOCK) {
+		NVMEV_ERROR("Invalid L2P eviction policy %u\n", l2p_evict_policy);
+		return -EINVAL;
+	}
+	if (gc_victim_policy > GC_VICTIM_WINDOWED) {
+		NVMEV_ERROR("Invalid GC victim policy %u\n", gc_victim_policy);
+		return -EINVAL;
+	}
+#endif
+
 	return 0;
 }
 
@@ -298,7 +400,7 @@ static void __print_perf_configs(void)
 
 static int __get_nr_entries(int dbs_idx, int queue_size)
 {
-	int diff = nvmev_vdev->dbs[dbs_idx] - nvmev_vdev->old_dbs[dbs_idx];
+	int diff = __get_io_db(dbs_idx) - nvmev_vdev->old_dbs[dbs_idx];
 	if (diff < 0) {
 		diff += queue_size;
 	}
@@ -467,7 +569,6 @@ static void NVMEV_STORAGE_FINAL(struct nvmev_dev *nvmev_vdev)
 
 static bool __load_configs(struct nvmev_config *config)
 {
-	bool first = true;
 	unsigned int cpu_nr;
 	char *cpu;
 
@@ -493,31 +594,55 @@ static bool __load_configs(struct nvmev_config *config)
 	config->write_trailing = write_trailing;
 	config->nr_io_units = nr_io_units;
 	config->io_unit_shift = io_unit_shift;
+#if (BASE_SSD == CONZONE_PROTOTYPE)
+	config->l2p_cache_size = l2p_cache_size;
+	config->l2p_cache_slots = l2p_cache_slots;
+	config->l2p_evict_policy = l2p_evict_policy;
+	config->gc_victim_policy = gc_victim_policy;
+#endif
+
+	if (nr_dispatchers == 0 || nr_dispatchers > ARRAY_SIZE(config->cpu_nr_dispatchers)) {
+		NVMEV_ERROR("Invalid nr_dispatchers %u\n", nr_dispatchers);
+		return false;
+	}
 
 	config->nr_io_workers = 0;
+	config->nr_dispatchers = 0;
 	config->cpu_nr_dispatcher = -1;
+	config->cpu_nr_dispatchers[0] = -1;
 
 	while ((cpu = strsep(&cpus, ",")) != NULL) {
 		cpu_nr = (unsigned int)simple_strtol(cpu, NULL, 10);
-		if (first) {
-			config->cpu_nr_dispatcher = cpu_nr;
+		if (config->nr_dispatchers < nr_dispatchers) {
+			config->cpu_nr_dispatchers[config->nr_dispatchers] = cpu_nr;
+			config->nr_dispatchers++;
 		} else {
 			config->cpu_nr_io_workers[config->nr_io_workers] = cpu_nr;
 			config->nr_io_workers++;
 		}
-		first = false;
 	}
+	if (config->nr_dispatchers == 0)
+		config->nr_dispatchers = 1;
+	config->cpu_nr_dispatcher = config->cpu_nr_dispatchers[0];
 
 	return true;
 }
 
+#if (BASE_SSD == CONZONE_PROTOTYPE)
+static inline bool __is_conzone_ns(int i)
+{
+	return NS_SSD_TYPE(i) == SSD_TYPE_CONZONE_ZONED || NS_SSD_TYPE(i) == SSD_TYPE_CONZONE_META ||
+		   NS_SSD_TYPE(i) == SSD_TYPE_CONZONE_BLOCK;
+}
+#endif
+
 static void NVMEV_NAMESPACE_INIT(struct nvmev_dev *nvmev_vdev)
 {
 	unsigned long long remaining_capacity = nvmev_vdev->config.storage_size;
 	void *ns_addr = nvmev_vdev->storage_mapped;
 	const int nr_ns = NR_NAMESPACES; // XXX: allow for dynamic nr_ns
 	const unsigned int disp_no = nvmev_vdev->config.cpu_nr_dispatcher;
-	int i;
+	int i, j;
 	unsigned long long size;
 
 	struct nvmev_ns *ns = kmalloc(sizeof(struct nvmev_ns) * nr_ns, GFP_KERNEL);
@@ -545,6 +670,22 @@ static void NVMEV_NAMESPACE_INIT(struct nvmev_dev *nvmev_vdev)
 		else
 			BUG_ON(1);
 
+		mutex_init(&ns[i].lock);
+		ns[i].ftl_lock = &ns[i].lock;
+		/* simple namespaces share io_unit_stat, conzone ones share the ssd */
+		for (j = 0; j < i; j++) {
+			if (NS_SSD_TYPE(j) == SSD_TYPE_NVM && NS_SSD_TYPE(i) == SSD_TYPE_NVM) {
+				ns[i].ftl_lock = ns[j].ftl_lock;
+				break;
+			}
+#if (BASE_SSD == CONZONE_PROTOTYPE)
+			if (__is_conzone_ns(j) && __is_conzone_ns(i)) {
+				ns[i].ftl_lock = ns[j].ftl_lock;
+				break;
+			}
+#endif
+		}
+
 		remaining_capacity -= size;
 		ns_addr += size;
 		NVMEV_INFO("ns %d/%d: size %lld MiB\n", i, nr_ns, BYTE_TO_MB(ns[i].size));
@@ -144,6 +144,7 @@ enum {
 	NVME_CTRL_ONCS_WRITE_UNCORRECTABLE = 1 << 1,
 	NVME_CTRL_ONCS_DSM = 1 << 2,
 	NVME_CTRL_VWC_PRESENT = 1 << 0,
+	NVME_CTRL_OACS_DBBUF_SUPP = 1 << 8,
 };
 
 struct nvme_lbaf {
@@ -5,6 +5,9 @@
 
 #include <linux/pci.h>
 #include <linux/msi.h>
+#include <linux/rbtree.h>
+#include <linux/mutex.h>
+#include <linux/dmaengine.h>
 #include <asm/apic.h>
 
 #include "nvme.h"
@@ -58,6 +61,7 @@
 
 #define NR_MAX_IO_QUEUE 72
 #define NR_MAX_PARALLEL_IO 16384
+#define NR_DMA_PRP_LIST 513 /* index 0 unused, up to 512 PRPs */
 
 #define NVMEV_INTX_IRQ 15
 
@@ -113,15 +117,20 @@ struct nvmev_completion_queue {
 	bool interrupt_ready;
 	bool phys_contig;
 
-	spinlock_t entry_lock;
 	struct mutex irq_lock;
 
 	int queue_size;
 
-	int phase;
-	int cq_head;
+	/* Entries ever reserved; gives the slot and the phase of the next one */
+	atomic64_t nr_reserved;
 	int cq_tail;
 
+	/* Interrupt coalescing (NVME_FEAT_IRQ_COALESCE) */
+	unsigned int irq_coalesce_thr; /* 0's based number of entries */
+	unsigned long long irq_coalesce_nsecs;
+	atomic_t nr_pending_entries; /* posted since the last interrupt */
+	unsigned long long nsecs_first_pending;
+
 	struct nvme_completion __iomem **cq;
 };
 
@@ -153,7 +162,9 @@ struct nvmev_config {
 	unsigned long storage_start; // byte
 	unsigned long storage_size;	 // byte
 
-	unsigned int cpu_nr_dispatcher;
+	unsigned int cpu_nr_dispatcher; /* the first dispatcher, also the I/O clock source */
+	unsigned int nr_dispatchers;
+	unsigned int cpu_nr_dispatchers[32];
 	unsigned int nr_io_workers;
 	unsigned int cpu_nr_io_workers[32];
 
@@ -167,6 +178,13 @@ struct nvmev_config {
 	unsigned int write_delay;	 // ns
 	unsigned int write_time;	 // ns
 	unsigned int write_trailing; // ns
+
+#if (BASE_SSD == CONZONE_PROTOTYPE)
+	unsigned long l2p_cache_size; // byte
+	unsigned int l2p_cache_slots;
+	unsigned int l2p_evict_policy;
+	unsigned int gc_victim_policy;
+#endif
 };
 
 struct nvmev_io_work {
@@ -186,6 +204,8 @@ struct nvmev_io_work {
 
 	bool is_copied;
 	bool is_completed;
+	bool is_dma_issued;
+	dma_cookie_t dma_cookie; /* last copy issued for this request */
 
 	unsigned int status;
 	unsigned int result0;
@@ -196,10 +216,14 @@ struct nvmev_io_work {
 	size_t buffs_to_release;
 
 	unsigned int next, prev;
+
+	struct rb_node rb; /* node in @work_tree of the owning worker */
+	unsigned long long nsecs_key; /* ordering key in @work_tree */
 };
 
 struct nvmev_io_worker {
 	struct nvmev_io_work *work_queue;
+	struct rb_root work_tree; /* index of io_seq chain ordered by target time */
 
 	unsigned int free_seq;	   /* free io req head index */
 	unsigned int free_seq_end; /* free io req tail index */
@@ -208,6 +232,10 @@ struct nvmev_io_worker {
 
 	unsigned long long latest_nsecs;
 
+	spinlock_t lock; /* serializes dispatchers enqueueing and reclaiming */
+
+	u64 *paddr_list; /* PRP list of the request being copied by DMA */
+
 	unsigned int id;
 	struct task_struct *task_struct;
 	char thread_name[32];
@@ -225,7 +253,9 @@ struct nvmev_dev {
 	struct pci_dev *pdev;
 
 	struct nvmev_config config;
-	struct task_struct *nvmev_dispatcher;
+	struct task_struct *nvmev_dispatcher[32];
+	/* held by a dispatcher while it walks its I/O queues */
+	struct mutex dispatcher_lock[32];
 
 	void *storage_mapped;
 
@@ -242,6 +272,10 @@ struct nvmev_dev {
 	u32 *old_dbs;
 	u32 __iomem *dbs;
 
+	/* Shadow doorbell and EventIdx buffers (Doorbell Buffer Config), I/O queues only */
+	u32 *dbbuf_dbs;
+	u32 *dbbuf_eis;
+
 	struct nvmev_ns *ns;
 	unsigned int nr_ns;
 	unsigned int nr_sq;
@@ -253,6 +287,10 @@ struct nvmev_dev {
 
 	unsigned int mdts;
 
+	/* NVME_FEAT_IRQ_COALESCE, applied to every I/O CQ */
+	unsigned int irq_coalesce_thr;
+	unsigned int irq_coalesce_time; /* 100 usec unit */
+
 	struct proc_dir_entry *proc_root;
 	struct proc_dir_entry *proc_read_times;
 	struct proc_dir_entry *proc_write_times;
@@ -284,6 +322,11 @@ struct nvmev_ns {
 	uint32_t nr_parts; // partitions
 	void *ftls;		   // ftl instances. one ftl per partition
 
+	/* serializes proc_io_cmd across dispatchers. namespaces sharing
+	 * the same FTL state point @ftl_lock to the same @lock */
+	struct mutex lock;
+	struct mutex *ftl_lock;
+
 	/*io command handler*/
 	bool (*proc_io_cmd)(struct nvmev_ns *ns, struct nvmev_request *req, struct nvmev_result *ret);
 
@@ -298,6 +341,8 @@ extern struct nvmev_dev *nvmev_vdev;
 struct nvmev_dev *VDEV_INIT(void);
 void VDEV_FINALIZE(struct nvmev_dev *nvmev_vdev);
 
+void nvmev_quiesce_dispatchers(void);
+
 // OPS_PCI
 bool nvmev_proc_bars(void);
 bool NVMEV_PCI_INIT(struct nvmev_dev *dev);
@@ -236,6 +236,10 @@ bool nvmev_proc_bars(void)
 			}
 		} else if (bar->cc.en == 0) {
 			bar->csts.rdy = 0;
+			/* Doorbell Buffer Config does not survive a controller reset */
+			WRITE_ONCE(nvmev_vdev->dbbuf_dbs, NULL);
+			WRITE_ONCE(nvmev_vdev->dbbuf_eis, NULL);
+			nvmev_quiesce_dispatchers();
 		}
 
 		/* Shutdown */
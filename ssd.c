@@ -1,7 +1,11 @@
 // SPDX-License-Identifier: GPL-2.0-only
 
+#include <linux/hash.h>
 #include <linux/ktime.h>
+#include <linux/log2.h>
+#include <linux/mm.h>
 #include <linux/sched/clock.h>
+#include <linux/slab.h>
 
 #include "nvmev.h"
 #include "ssd.h"
@@ -21,6 +25,10 @@ void buffer_init(struct buffer *buf, size_t size)
 	for (int i = 0; i < buf->tt_lpns; i++) {
 		buf->lpns[i] = INVALID_LPN;
 	}
+#if (BASE_SSD == CONZONE_PROTOTYPE)
+	/* callers that need the lpn index allocate it with lpn_set_init() */
+	buf->lpn_idx.slots = NULL;
+#endif
 	buf->pgs = 0;
 	buf->sqid = 0;
 	buf->busy = false;
@@ -96,43 +104,159 @@ void buffer_refill(struct buffer *buf)
 	spin_unlock(&buf->lock);
 }
 
-void buffer_remove(struct buffer *buf) { kfree(buf->lpns); }
+#if (BASE_SSD == CONZONE_PROTOTYPE)
+void lpn_set_init(struct lpn_set *set, uint64_t max_lpns)
+{
+	set->bits = ilog2(roundup_pow_of_two(max_t(uint64_t, max_lpns, 1) * 2));
+	set->slots = kmalloc_array(1UL << set->bits, sizeof(uint64_t), GFP_KERNEL);
+	for (int i = 0; i < (1UL << set->bits); i++) {
+		set->slots[i] = INVALID_LPN;
+	}
+}
+
+void lpn_set_free(struct lpn_set *set)
+{
+	kfree(set->slots);
+	set->slots = NULL;
+}
+
+static uint32_t __lpn_set_slot(struct lpn_set *set, uint64_t lpn)
+{
+	uint32_t mask = (1U << set->bits) - 1;
+	uint32_t i = hash_64(lpn, set->bits);
+
+	while (set->slots[i] != INVALID_LPN && set->slots[i] != lpn)
+		i = (i + 1) & mask;
+	return i;
+}
+
+/* an unallocated set tracks nothing */
+void lpn_set_add(struct lpn_set *set, uint64_t lpn)
+{
+	if (set->slots)
+		set->slots[__lpn_set_slot(set, lpn)] = lpn;
+}
+
+bool lpn_set_has(struct lpn_set *set, uint64_t lpn)
+{
+	return set->slots && set->slots[__lpn_set_slot(set, lpn)] == lpn;
+}
+
+/* backward-shift deletion keeps every probe chain intact without tombstones */
+bool lpn_set_del(struct lpn_set *set, uint64_t lpn)
+{
+	uint32_t mask, i, j, home;
+
+	if (!set->slots)
+		return false;
+
+	mask = (1U << set->bits) - 1;
+	i = __lpn_set_slot(set, lpn);
+	if (set->slots[i] != lpn)
+		return false;
+
+	for (j = (i + 1) & mask; set->slots[j] != INVALID_LPN; j = (j + 1) & mask) {
+		home = hash_64(set->slots[j], set->bits);
+		/* slots[j] may fill the hole only if its home is not in (i, j] */
+		if (((j - home) & mask) >= ((j - i) & mask)) {
+			set->slots[i] = set->slots[j];
+			i = j;
+		}
+	}
+	set->slots[i] = INVALID_LPN;
+	return true;
+}
+
+void buffer_add_lpn(struct buffer *buf, uint64_t lpn)
+{
+	buf->lpns[buf->pgs++] = lpn;
+	lpn_set_add(&buf->lpn_idx, lpn);
+}
+
+bool buffer_has_lpn(struct buffer *buf, uint64_t lpn)
+{
+	return lpn_set_has(&buf->lpn_idx, lpn);
+}
+
+void buffer_clear_lpns(struct buffer *buf)
+{
+	for (int i = 0; i < buf->pgs; i++) {
+		lpn_set_del(&buf->lpn_idx, buf->lpns[i]);
+		buf->lpns[i] = INVALID_LPN;
+	}
+	buf->pgs = 0;
+}
+#endif
+
+void buffer_remove(struct buffer *buf)
+{
+#if (BASE_SSD == CONZONE_PROTOTYPE)
+	lpn_set_free(&buf->lpn_idx);
+#endif
+	kfree(buf->lpns);
+}
 
 #if (BASE_SSD == CONZONE_PROTOTYPE)
-static void ssd_init_l2pcache(struct l2pcache *cache)
+static void ssd_init_l2pcache(struct l2pcache *cache, struct ssdparams *spp)
 {
+	const int ns_quota[NR_NAMESPACES] = L2P_NS_QUOTA;
 	int i, j;
 
-	cache->size = L2P_CACHE_SIZE / L2P_ENTRY_SIZE; //# of entries
-	cache->evict_policy = L2P_EVICT_POLICY;
-	cache->num_slots = L2P_CACHE_HASH_SLOT;
+	cache->size = spp->l2p_cache_size / L2P_ENTRY_SIZE; //# of entries
+	cache->evict_policy = spp->l2p_evict_policy;
+	cache->num_slots = spp->l2p_cache_slots;
 
 	cache->slot_size = cache->size / cache->num_slots;
 	cache->mapping = kmalloc(sizeof(struct l2pcache_ent *) * (cache->num_slots), GFP_KERNEL);
 	cache->slot_len = kmalloc(sizeof(int) * cache->num_slots, GFP_KERNEL);
 	cache->head = kmalloc(sizeof(int) * cache->num_slots, GFP_KERNEL);
 	cache->tail = kmalloc(sizeof(int) * cache->num_slots, GFP_KERNEL);
+	cache->a1_size = cache->slot_size * L2P_2Q_A1_RATIO / 100;
+	cache->a1_len = kmalloc(sizeof(int) * cache->num_slots, GFP_KERNEL);
+	cache->a1_head = kmalloc(sizeof(int) * cache->num_slots, GFP_KERNEL);
+	cache->a1_tail = kmalloc(sizeof(int) * cache->num_slots, GFP_KERNEL);
+	cache->hand = kmalloc(sizeof(int) * cache->num_slots, GFP_KERNEL);
+
+	for (i = 0; i < NR_NAMESPACES; i++) {
+		cache->owner[i] = NULL;
+		cache->quota[i] = cache->slot_size * ns_quota[i] / 100;
+		cache->ns_len[i] = kcalloc(cache->num_slots, sizeof(int), GFP_KERNEL);
+	}
 
 	for (i = 0; i < cache->num_slots; i++) {
-		cache->mapping[i] = kmalloc(sizeof(struct l2pcache_ent) * (cache->slot_size), GFP_KERNEL);
+		cache->mapping[i] = kvmalloc_array(cache->slot_size, sizeof(struct l2pcache_ent), GFP_KERNEL);
 		for (j = 0; j < cache->slot_size; j++) {
 			cache->mapping[i][j].lpn = INVALID_LPN;
 			cache->mapping[i][j].granularity = PAGE_MAP;
 			cache->mapping[i][j].resident = 0;
+			cache->mapping[i][j].nsid = -1;
+			cache->mapping[i][j].queue = L2P_QUEUE_MAIN;
+			cache->mapping[i][j].ref = 0;
+			cache->mapping[i][j].dirty = 0;
 			cache->mapping[i][j].last = -1;
 			cache->mapping[i][j].next = -1;
 		}
-		cache->head[i] = 0;
-		cache->tail[i] = 0;
+		cache->head[i] = -1;
+		cache->tail[i] = -1;
 		cache->slot_len[i] = 0;
+		cache->a1_head[i] = -1;
+		cache->a1_tail[i] = -1;
+		cache->a1_len[i] = 0;
+		cache->hand[i] = 0;
 	}
 }
 
 static void ssd_remove_l2pcache(struct l2pcache *cache)
 {
 	for (int i = 0; i < cache->num_slots; i++) {
-		kfree(cache->mapping[i]);
+		kvfree(cache->mapping[i]);
 	}
+	for (int i = 0; i < NR_NAMESPACES; i++)
+		kfree(cache->ns_len[i]);
+	kfree(cache->hand);
+	kfree(cache->a1_tail);
+	kfree(cache->a1_head);
+	kfree(cache->a1_len);
 	kfree(cache->tail);
 	kfree(cache->head);
 	kfree(cache->slot_len);
@@ -151,6 +275,14 @@ static void check_params(struct ssdparams *spp)
 	// ftl_assert(is_power_of_2(spp->nchs));
 }
 
+#if (BASE_SSD == CONZONE_PROTOTYPE)
+/* a zero-sized dimension would fault on first use anyway; keep the divisor defined */
+static struct reciprocal_value __reciprocal(unsigned long d)
+{
+	return reciprocal_value(max_t(unsigned long, d, 1));
+}
+#endif
+
 void ssd_init_params(struct ssdparams *spp, uint64_t capacity, uint32_t nparts)
 {
 	uint64_t blk_size, total_size, meta_size;
@@ -174,6 +306,11 @@ void ssd_init_params(struct ssdparams *spp, uint64_t capacity, uint32_t nparts)
 	spp->pslc_blks = pSLC_INIT_BLKS;
 	spp->meta_pslc_blks = META_pSLC_INIT_BLKS;
 	spp->meta_normal_blks = 0; // FIX: should be zero
+
+	/* defaults, module parameters override them before ssd_init */
+	spp->l2p_cache_size = L2P_CACHE_SIZE;
+	spp->l2p_cache_slots = L2P_CACHE_HASH_SLOT;
+	spp->l2p_evict_policy = L2P_EVICT_POLICY;
 #endif
 
 	if (BLKS_PER_PLN > 0) {
@@ -342,6 +479,18 @@ void ssd_init_params(struct ssdparams *spp, uint64_t capacity, uint32_t nparts)
 	spp->pslc_pgs_per_blk = DIV_ROUND_UP(spp->pslc_blksz, spp->pgsz);
 	spp->pslc_pgs_per_line = spp->blks_per_line * spp->pslc_pgs_per_blk;
 
+	spp->luns_per_group = spp->tt_luns / spp->line_groups;
+	spp->rows_per_group = spp->luns_per_group / spp->nchs;
+	spp->pgs_per_stripe = spp->pgs_per_flashpg * spp->pls_per_lun * spp->nchs * spp->rows_per_group;
+	spp->rd_nchs = __reciprocal(spp->nchs);
+	spp->rd_line_groups = __reciprocal(spp->line_groups);
+	spp->rd_luns_per_group = __reciprocal(spp->luns_per_group);
+	spp->rd_rows_per_group = __reciprocal(spp->rows_per_group);
+	spp->rd_pls_per_lun = __reciprocal(spp->pls_per_lun);
+	spp->rd_pgs_per_flashpg = __reciprocal(spp->pgs_per_flashpg);
+	spp->rd_pslc_pgs_per_flashpg = __reciprocal(spp->pslc_pgs_per_flashpg);
+	spp->rd_pgs_per_stripe = __reciprocal(spp->pgs_per_stripe);
+
 	NVMEV_INFO("[Total pSLC Superblocks] %llu [Meta pSLC Superblocks] %llu [Meta Normal "
 			   "Superblocks] %llu\n",
 			   spp->pslc_blks, spp->meta_pslc_blks, spp->meta_normal_blks);
@@ -409,6 +558,16 @@ static void ssd_remove_nand_blk(struct nand_block *blk)
 	kfree(blk->pg);
 }
 
+static void ssd_init_cmdq(struct nand_cmd_queue *q)
+{
+	INIT_LIST_HEAD(&q->cmds);
+	INIT_LIST_HEAD(&q->migs);
+	q->base = 0;
+	q->total = 0;
+	q->depth = 0;
+	q->max_depth = 0;
+}
+
 static void ssd_init_nand_plane(struct nand_plane *pl, struct ssdparams *spp)
 {
 	int i;
@@ -432,11 +591,9 @@ static void ssd_init_nand_plane(struct nand_plane *pl, struct ssdparams *spp)
 	}
 #if (BASE_SSD == CONZONE_PROTOTYPE)
 	pl->next_pln_avail_time = 0;
-	INIT_LIST_HEAD(&pl->cmd_queue_head);
+	ssd_init_cmdq(&pl->cmdq);
 	pl->migrating = false;
 	pl->migrating_etime = 0;
-	pl->cmd_queue_depth = 0;
-	pl->max_cmd_queue_depth = 0;
 	pl->busy = false;
 #endif
 }
@@ -460,11 +617,9 @@ static void ssd_init_nand_lun(struct nand_lun *lun, struct ssdparams *spp)
 		ssd_init_nand_plane(&lun->pl[i], spp);
 	}
 	lun->next_lun_avail_time = 0;
-	INIT_LIST_HEAD(&lun->cmd_queue_head);
+	ssd_init_cmdq(&lun->cmdq);
 	lun->migrating_etime = 0;
 	lun->migrating = false;
-	lun->cmd_queue_depth = 0;
-	lun->max_cmd_queue_depth = 0;
 	lun->busy = false;
 }
 
@@ -532,14 +687,46 @@ void ssd_init(struct ssd *ssd, struct ssdparams *spp, uint32_t cpu_nr_dispatcher
 
 	ssd->write_buffer = kmalloc(sizeof(struct buffer), GFP_KERNEL);
 	buffer_init(ssd->write_buffer, spp->write_buffer_size);
+#if (BASE_SSD == CONZONE_PROTOTYPE)
+	/* shared by every namespace, block namespaces included */
+	if (spp->write_buffer_size)
+		lpn_set_init(&ssd->write_buffer->lpn_idx, ssd->write_buffer->tt_lpns);
+#endif
+
+	ssd->cmd_cache = NULL;
+	ssd->nr_cmd_allocs = 0;
+	ssd->nr_cmd_frees = 0;
+
+	ssd->next_avail_time = 0;
+	ssd->migrating_etime = 0;
+	ssd->nr_migrating = 0;
 
 #if (BASE_SSD == CONZONE_PROTOTYPE)
-	ssd_init_l2pcache(&ssd->l2pcache);
+	ssd_init_l2pcache(&ssd->l2pcache, spp);
+
+	/* Only the plane queues of the prototype keep nand_cmd around */
+	ssd->cmd_cache = kmem_cache_create("nvmev_nand_cmd", sizeof(struct nand_cmd), 0,
+									   SLAB_HWCACHE_ALIGN, NULL);
 #endif
 
 	return;
 }
 
+struct nand_cmd *ssd_alloc_nand_cmd(struct ssd *ssd)
+{
+	struct nand_cmd *cmd = kmem_cache_alloc(ssd->cmd_cache, GFP_KERNEL);
+
+	if (cmd)
+		ssd->nr_cmd_allocs++;
+	return cmd;
+}
+
+void ssd_free_nand_cmd(struct ssd *ssd, struct nand_cmd *cmd)
+{
+	ssd->nr_cmd_frees++;
+	kmem_cache_free(ssd->cmd_cache, cmd);
+}
+
 void ssd_remove(struct ssd *ssd)
 {
 	uint32_t i;
@@ -557,14 +744,14 @@ void ssd_remove(struct ssd *ssd)
 
 				struct nand_plane *plp = get_pl(ssd, &ppa);
 				NVMEV_INFO("[Channel %d Lun %d Plane %d] [Max CMD Queue Depth] %llu\n", ch, lun, pl,
-						   plp->max_cmd_queue_depth);
+						   plp->cmdq.max_depth);
 
 				struct nand_cmd *cmd =
-					list_first_entry_or_null(&plp->cmd_queue_head, struct nand_cmd, entry);
+					list_first_entry_or_null(&plp->cmdq.cmds, struct nand_cmd, entry);
 				while (cmd) {
 					list_del_init(&cmd->entry);
-					kfree(cmd);
-					cmd = list_first_entry_or_null(&plp->cmd_queue_head, struct nand_cmd, entry);
+					ssd_free_nand_cmd(ssd, cmd);
+					cmd = list_first_entry_or_null(&plp->cmdq.cmds, struct nand_cmd, entry);
 				}
 			}
 		}
@@ -578,17 +765,20 @@ void ssd_remove(struct ssd *ssd)
 
 			struct nand_lun *lunp = get_lun(ssd, &ppa);
 			NVMEV_INFO("[Channel %d Lun %d] [Max CMD Queue Depth] %llu\n", ch, lun,
-					   lunp->max_cmd_queue_depth);
+					   lunp->cmdq.max_depth);
 			struct nand_cmd *cmd =
-				list_first_entry_or_null(&lunp->cmd_queue_head, struct nand_cmd, entry);
+				list_first_entry_or_null(&lunp->cmdq.cmds, struct nand_cmd, entry);
 			while (cmd) {
 				list_del_init(&cmd->entry);
-				kfree(cmd);
-				cmd = list_first_entry_or_null(&lunp->cmd_queue_head, struct nand_cmd, entry);
+				ssd_free_nand_cmd(ssd, cmd);
+				cmd = list_first_entry_or_null(&lunp->cmdq.cmds, struct nand_cmd, entry);
 			}
 		}
 	}
 #endif
+	NVMEV_INFO("[nand_cmd] allocs %llu frees %llu\n", ssd->nr_cmd_allocs, ssd->nr_cmd_frees);
+	kmem_cache_destroy(ssd->cmd_cache);
+
 	buffer_remove(ssd->write_buffer);
 	kfree(ssd->write_buffer);
 	if (ssd->pcie) {
@@ -633,81 +823,140 @@ uint64_t ssd_advance_write_buffer(struct ssd *ssd, uint64_t request_time, uint64
 	return nsecs_latest;
 }
 
-static bool lun_getstime(struct nand_lun *lun, struct nand_cmd *ncmd, uint64_t ncmd_stime)
-{
 #if (BASE_SSD == CONZONE_PROTOTYPE)
-	// Clear the current completed requests
-	struct nand_cmd *cmd, *next_cmd;
-	list_for_each_entry_safe(cmd, next_cmd, &lun->cmd_queue_head, entry)
+/*
+ * Plane/LUN command queues, kept in execution order: both stime and ctime are
+ * non-decreasing along @cmds, completed requests are popped from the head.
+ *
+ * A preempting request is queued in front of the first eligible MIGRATE_IO,
+ * which is searched on @migs so queued host requests are never walked. The
+ * delay it causes is not written into the suffix behind it: it is added to
+ * @shift of that MIGRATE_IO and applies to it and every request behind it.
+ * A request's stime/ctime were recorded when the shifts in front of it summed
+ * to @qoff, so its times now are stime/ctime + (shifts in front of it) - qoff.
+ * Shifts of popped requests are folded into @base, @total is @base plus the
+ * shifts still queued, i.e. the offset of the tail.
+ */
+static inline uint64_t cmdq_off(struct nand_cmd *cmd, uint64_t shifts)
+{
+	return shifts - cmd->qoff;
+}
+
+static void cmdq_enqueue_tail(struct nand_cmd_queue *q, struct nand_cmd *ncmd)
+{
+	ncmd->qoff = q->total;
+	ncmd->shift = 0;
+	list_add_tail(&ncmd->entry, &q->cmds);
+	if (ncmd->type == MIGRATE_IO)
+		list_add_tail(&ncmd->mig_entry, &q->migs);
+	q->depth++;
+	q->max_depth = max(q->max_depth, q->depth);
+}
+
+// pop the requests completed before t
+static void cmdq_prune(struct ssd *ssd, struct nand_cmd_queue *q, uint64_t t)
+{
+	struct nand_cmd *cmd;
+
+	while ((cmd = list_first_entry_or_null(&q->cmds, struct nand_cmd, entry))) {
+		if (cmd->ctime + cmdq_off(cmd, q->base + cmd->shift) >= t)
+			break;
+		list_del(&cmd->entry);
+		if (cmd->type == MIGRATE_IO)
+			list_del(&cmd->mig_entry);
+		q->base += cmd->shift;
+		q->depth--;
+		ssd_free_nand_cmd(ssd, cmd);
+	}
+}
+
+// queue @ncmd in front of the first MIGRATE_IO not started at t on another block
+static bool cmdq_preempt(struct nand_cmd_queue *q, struct nand_cmd *ncmd, uint64_t t)
+{
+	uint64_t shifts = q->base;
+	struct nand_cmd *cmd;
+
+	list_for_each_entry(cmd, &q->migs, mig_entry)
 	{
-		if (cmd->ctime < ncmd_stime) {
-			list_del(&cmd->entry);
-			lun->cmd_queue_depth--;
-			kfree(cmd);
+		uint64_t stime = cmd->stime + cmdq_off(cmd, shifts + cmd->shift);
+
+		if (stime > t && cmd->ppa.zms.blk != ncmd->ppa.zms.blk) {
+			ncmd->stime = stime;
+			ncmd->qoff = shifts;
+			ncmd->shift = 0;
+			list_add_tail(&ncmd->entry, &cmd->entry);
+			q->depth++;
+			q->max_depth = max(q->max_depth, q->depth);
+			return true;
 		}
+		shifts += cmd->shift;
 	}
-	if (ncmd_stime > lun->migrating_etime)
+	return false;
+}
+
+/*
+ * delay the requests behind the preempting @ncmd by @delay, returns the new
+ * ctime of the last MIGRATE_IO
+ */
+static uint64_t cmdq_delay(struct nand_cmd_queue *q, struct nand_cmd *ncmd, uint64_t delay)
+{
+	struct nand_cmd *mig = list_next_entry(ncmd, entry);
+	struct nand_cmd *last = list_last_entry(&q->migs, struct nand_cmd, mig_entry);
+
+	mig->shift += delay;
+	q->total += delay;
+	return last->ctime + cmdq_off(last, q->total);
+}
+
+static bool lun_getstime(struct ssd *ssd, struct nand_lun *lun, struct nand_cmd *ncmd,
+						 uint64_t ncmd_stime)
+{
+	cmdq_prune(ssd, &lun->cmdq, ncmd_stime);
+	if (lun->migrating && ncmd_stime > lun->migrating_etime) {
 		lun->migrating = false;
+		ssd->nr_migrating--;
+	}
 
 	bool preemp = false;
-	if (ncmd->type != MIGRATE_IO && lun->migrating) {
-		list_for_each_entry_safe(cmd, next_cmd, &lun->cmd_queue_head, entry)
-		{
-			if (cmd->type == MIGRATE_IO && cmd->stime > ncmd_stime &&
-				cmd->ppa.zms.blk != ncmd->ppa.zms.blk) {
-				list_add_tail(&ncmd->entry, &cmd->entry);
-				lun->cmd_queue_depth++;
-				lun->max_cmd_queue_depth = max(lun->max_cmd_queue_depth, lun->cmd_queue_depth);
-				ncmd->stime = cmd->stime;
-				preemp = true;
-				break;
-			}
-		}
-	}
+	if (ncmd->type != MIGRATE_IO && lun->migrating)
+		preemp = cmdq_preempt(&lun->cmdq, ncmd, ncmd_stime);
 
 	if (!preemp) {
-		list_add_tail(&ncmd->entry, &lun->cmd_queue_head);
-		lun->cmd_queue_depth++;
-		lun->max_cmd_queue_depth = max(lun->max_cmd_queue_depth, lun->cmd_queue_depth);
 		ncmd->stime = max(lun->next_lun_avail_time, ncmd_stime);
+		cmdq_enqueue_tail(&lun->cmdq, ncmd);
 
 		if (ncmd->type == MIGRATE_IO && !lun->migrating) {
 			lun->migrating = true;
+			ssd->nr_migrating++;
 		}
 	}
 
 	NVMEV_CONZONE_PRINT_TIME(
 		"%s: preemp %d current queue depth %llu lun next avaial time %llu ncmd submit time "
 		"%llu ncmd stime %llu\n",
-		__func__, preemp, lun->cmd_queue_depth, lun->next_lun_avail_time, ncmd_stime, ncmd->stime);
+		__func__, preemp, lun->cmdq.depth, lun->next_lun_avail_time, ncmd_stime, ncmd->stime);
 	return preemp;
+}
 #else
+static bool lun_getstime(struct ssd *ssd, struct nand_lun *lun, struct nand_cmd *ncmd,
+						 uint64_t ncmd_stime)
+{
 	ncmd->stime = max(lun->next_lun_avail_time, ncmd_stime);
 	return false;
-#endif
 }
+#endif
 
-static void lun_update(struct nand_lun *lun, struct nand_cmd *ncmd, bool preemp, uint64_t cmd_etime)
+static void lun_update(struct ssd *ssd, struct nand_lun *lun, struct nand_cmd *ncmd, bool preemp,
+					   uint64_t cmd_etime)
 {
 #if (BASE_SSD == CONZONE_PROTOTYPE)
 	if (preemp) {
-		struct nand_cmd *cmd, *next_cmd;
-		bool delay = false;
-		list_for_each_entry_safe(cmd, next_cmd, &lun->cmd_queue_head, entry)
-		{
-			if (delay) {
-				cmd->stime += cmd_etime - ncmd->stime;
-				cmd->ctime += cmd_etime - ncmd->stime;
-
-				if (cmd->type == MIGRATE_IO) {
-					lun->migrating_etime = max(lun->migrating_etime, cmd->ctime);
-				}
-			}
-			if (cmd == ncmd) {
-				delay = true;
-			}
-		}
-		lun->next_lun_avail_time += cmd_etime - ncmd->stime;
+		/* Only the requests queued behind @ncmd are delayed */
+		uint64_t delay = cmd_etime - ncmd->stime;
+		uint64_t mig_etime = cmdq_delay(&lun->cmdq, ncmd, delay);
+
+		lun->migrating_etime = max(lun->migrating_etime, mig_etime);
+		lun->next_lun_avail_time += delay;
 	} else {
 		lun->next_lun_avail_time = cmd_etime;
 	}
@@ -719,6 +968,8 @@ static void lun_update(struct nand_lun *lun, struct nand_cmd *ncmd, bool preemp,
 	if (ncmd->type == MIGRATE_IO) {
 		lun->migrating_etime = max(lun->migrating_etime, ncmd->ctime);
 	}
+	ssd->next_avail_time = max(ssd->next_avail_time, lun->next_lun_avail_time);
+	ssd->migrating_etime = max(ssd->migrating_etime, lun->migrating_etime);
 
 	NVMEV_CONZONE_PRINT_TIME(
 		"%s: preemp %d lun next avaial time %llu complete time %llu ncmd ctime %llu\n", __func__,
@@ -726,42 +977,20 @@ static void lun_update(struct nand_lun *lun, struct nand_cmd *ncmd, bool preemp,
 }
 
 #if (BASE_SSD == CONZONE_PROTOTYPE)
-static bool plane_getstime(struct nand_plane *pl, struct nand_cmd *ncmd, uint64_t ncmd_stime)
+static bool plane_getstime(struct ssd *ssd, struct nand_plane *pl, struct nand_cmd *ncmd,
+						   uint64_t ncmd_stime)
 {
-	// Clear the current completed requests
-	struct nand_cmd *cmd, *next_cmd;
-	list_for_each_entry_safe(cmd, next_cmd, &pl->cmd_queue_head, entry)
-	{
-		if (cmd->ctime < ncmd_stime) {
-			list_del(&cmd->entry);
-			pl->cmd_queue_depth--;
-			kfree(cmd);
-		}
-	}
+	cmdq_prune(ssd, &pl->cmdq, ncmd_stime);
 	if (ncmd_stime > pl->migrating_etime)
 		pl->migrating = false;
 
 	bool preemp = false;
-	if (ncmd->type != MIGRATE_IO && pl->migrating) {
-		list_for_each_entry_safe(cmd, next_cmd, &pl->cmd_queue_head, entry)
-		{
-			if (cmd->type == MIGRATE_IO && cmd->stime > ncmd_stime &&
-				cmd->ppa.zms.blk != ncmd->ppa.zms.blk) {
-				list_add_tail(&ncmd->entry, &cmd->entry);
-				pl->cmd_queue_depth++;
-				pl->max_cmd_queue_depth = max(pl->max_cmd_queue_depth, pl->cmd_queue_depth);
-				ncmd->stime = cmd->stime;
-				preemp = true;
-				break;
-			}
-		}
-	}
+	if (ncmd->type != MIGRATE_IO && pl->migrating)
+		preemp = cmdq_preempt(&pl->cmdq, ncmd, ncmd_stime);
 
 	if (!preemp) {
-		list_add_tail(&ncmd->entry, &pl->cmd_queue_head);
-		pl->cmd_queue_depth++;
-		pl->max_cmd_queue_depth = max(pl->max_cmd_queue_depth, pl->cmd_queue_depth);
 		ncmd->stime = max(pl->next_pln_avail_time, ncmd_stime);
+		cmdq_enqueue_tail(&pl->cmdq, ncmd);
 
 		if (ncmd->type == MIGRATE_IO && !pl->migrating) {
 			pl->migrating = true;
@@ -771,31 +1000,20 @@ static bool plane_getstime(struct nand_plane *pl, struct nand_cmd *ncmd, uint64_
 	NVMEV_CONZONE_PRINT_TIME(
 		"%s: preemp %d current queue depth %llu plane next avail time %llu ncmd submit time "
 		"%llu ncmd stime %llu\n",
-		__func__, preemp, pl->cmd_queue_depth, pl->next_pln_avail_time, ncmd_stime, ncmd->stime);
+		__func__, preemp, pl->cmdq.depth, pl->next_pln_avail_time, ncmd_stime, ncmd->stime);
 	return preemp;
 }
 
-static void plane_update(struct nand_plane *pl, struct nand_cmd *ncmd, bool preemp,
-						 uint64_t cmd_etime)
+static void plane_update(struct ssd *ssd, struct nand_plane *pl, struct nand_cmd *ncmd,
+						 bool preemp, uint64_t cmd_etime)
 {
 	if (preemp) {
-		struct nand_cmd *cmd, *next_cmd;
-		bool delay = false;
-		list_for_each_entry_safe(cmd, next_cmd, &pl->cmd_queue_head, entry)
-		{
-			if (delay) {
-				cmd->stime += cmd_etime - ncmd->stime;
-				cmd->ctime += cmd_etime - ncmd->stime;
-
-				if (cmd->type == MIGRATE_IO) {
-					pl->migrating_etime = max(pl->migrating_etime, cmd->ctime);
-				}
-			}
-			if (cmd == ncmd) {
-				delay = true;
-			}
-		}
-		pl->next_pln_avail_time += cmd_etime - ncmd->stime;
+		/* Only the requests queued behind @ncmd are delayed */
+		uint64_t delay = cmd_etime - ncmd->stime;
+		uint64_t mig_etime = cmdq_delay(&pl->cmdq, ncmd, delay);
+
+		pl->migrating_etime = max(pl->migrating_etime, mig_etime);
+		pl->next_pln_avail_time += delay;
 	} else {
 		pl->next_pln_avail_time = cmd_etime;
 	}
@@ -804,6 +1022,7 @@ static void plane_update(struct nand_plane *pl, struct nand_cmd *ncmd, bool pree
 	if (ncmd->type == MIGRATE_IO) {
 		pl->migrating_etime = max(pl->migrating_etime, ncmd->ctime);
 	}
+	ssd->next_avail_time = max(ssd->next_avail_time, pl->next_pln_avail_time);
 
 	NVMEV_CONZONE_PRINT_TIME(
 		"%s: preemp %d plane next avail time %llu complete time %llu ncmd ctime %llu\n", __func__,
@@ -843,7 +1062,7 @@ uint64_t ssd_advance_nand(struct ssd *ssd, struct nand_cmd *ncmd)
 	cell = get_cell(ssd, ppa);
 	cell_mode = blk->nand_type;
 	remaining = ncmd->xfer_size;
-	if (ncmd->type == MAP_READ_IO) {
+	if (ncmd->type == MAP_READ_IO || ncmd->type == MAP_WRITE_IO) {
 		cell_mode = CELL_MODE_SLC;
 	}
 	if (cell_mode == CELL_MODE_SLC) {
@@ -854,9 +1073,9 @@ uint64_t ssd_advance_nand(struct ssd *ssd, struct nand_cmd *ncmd)
 	case NAND_READ:
 		/* read: perform NAND cmd first */
 #if (BASE_SSD == CONZONE_PROTOTYPE)
-		preemp = plane_getstime(pl, ncmd, cmd_stime);
+		preemp = plane_getstime(ssd, pl, ncmd, cmd_stime);
 #else
-		preemp = lun_getstime(lun, ncmd, cmd_stime);
+		preemp = lun_getstime(ssd, lun, ncmd, cmd_stime);
 #endif
 		nand_stime = ncmd->stime;
 
@@ -884,17 +1103,17 @@ uint64_t ssd_advance_nand(struct ssd *ssd, struct nand_cmd *ncmd)
 		}
 
 #if (BASE_SSD == CONZONE_PROTOTYPE)
-		plane_update(pl, ncmd, preemp, chnl_etime);
+		plane_update(ssd, pl, ncmd, preemp, chnl_etime);
 #else
-		lun_update(lun, ncmd, preemp, chnl_etime);
+		lun_update(ssd, lun, ncmd, preemp, chnl_etime);
 #endif
 		break;
 	case NAND_WRITE:
 		/* write: transfer data through channel first */
 #if (BASE_SSD == CONZONE_PROTOTYPE)
-		preemp = plane_getstime(pl, ncmd, cmd_stime);
+		preemp = plane_getstime(ssd, pl, ncmd, cmd_stime);
 #else
-		preemp = lun_getstime(lun, ncmd, cmd_stime);
+		preemp = lun_getstime(ssd, lun, ncmd, cmd_stime);
 #endif
 		chnl_stime = ncmd->stime;
 
@@ -904,9 +1123,9 @@ uint64_t ssd_advance_nand(struct ssd *ssd, struct nand_cmd *ncmd)
 		nand_stime = chnl_etime;
 		nand_etime = nand_stime + spp->pg_wr_lat[cell_mode];
 #if (BASE_SSD == CONZONE_PROTOTYPE)
-		plane_update(pl, ncmd, preemp, nand_etime);
+		plane_update(ssd, pl, ncmd, preemp, nand_etime);
 #else
-		lun_update(lun, ncmd, preemp, nand_etime);
+		lun_update(ssd, lun, ncmd, preemp, nand_etime);
 #endif
 		completed_time = nand_etime;
 		break;
@@ -914,16 +1133,16 @@ uint64_t ssd_advance_nand(struct ssd *ssd, struct nand_cmd *ncmd)
 	case NAND_ERASE:
 		/* erase: only need to advance NAND status */
 #if (BASE_SSD == CONZONE_PROTOTYPE)
-		preemp = plane_getstime(pl, ncmd, cmd_stime);
+		preemp = plane_getstime(ssd, pl, ncmd, cmd_stime);
 #else
-		preemp = lun_getstime(lun, ncmd, cmd_stime);
+		preemp = lun_getstime(ssd, lun, ncmd, cmd_stime);
 #endif
 		nand_stime = ncmd->stime;
 		nand_etime = nand_stime + spp->blk_er_lat;
 #if (BASE_SSD == CONZONE_PROTOTYPE)
-		plane_update(pl, ncmd, preemp, nand_etime);
+		plane_update(ssd, pl, ncmd, preemp, nand_etime);
 #else
-		lun_update(lun, ncmd, preemp, nand_etime);
+		lun_update(ssd, lun, ncmd, preemp, nand_etime);
 #endif
 		completed_time = nand_etime;
 		break;
@@ -937,6 +1156,7 @@ uint64_t ssd_advance_nand(struct ssd *ssd, struct nand_cmd *ncmd)
 		nand_stime = max(lun->next_lun_avail_time, cmd_stime);
 		lun->next_lun_avail_time = nand_stime;
 #endif
+		ssd->next_avail_time = max(ssd->next_avail_time, nand_stime);
 		completed_time = nand_stime;
 		break;
 
@@ -951,27 +1171,7 @@ uint64_t ssd_advance_nand(struct ssd *ssd, struct nand_cmd *ncmd)
 
 uint64_t ssd_next_idle_time(struct ssd *ssd)
 {
-	struct ssdparams *spp = &ssd->sp;
-	uint32_t i, j;
-	uint64_t latest = __get_ioclock(ssd);
-
-	for (i = 0; i < spp->nchs; i++) {
-		struct ssd_channel *ch = &ssd->ch[i];
-
-		for (j = 0; j < spp->luns_per_ch; j++) {
-			struct nand_lun *lun = &ch->lun[j];
-#if (BASE_SSD == CONZONE_PROTOTYPE)
-			for (int k = 0; k < spp->pls_per_lun; k++) {
-				struct nand_plane *pl = &lun->pl[k];
-				latest = max(latest, pl->next_pln_avail_time);
-			}
-#else
-			latest = max(latest, lun->next_lun_avail_time);
-#endif
-		}
-	}
-
-	return latest;
+	return max(__get_ioclock(ssd), ssd->next_avail_time);
 }
 
 void adjust_ftl_latency(int target, int lat)
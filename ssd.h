@@ -3,6 +3,7 @@
 #ifndef _NVMEVIRT_SSD_H
 #define _NVMEVIRT_SSD_H
 
+#include <linux/reciprocal_div.h>
 #include <linux/types.h>
 #include "pqueue/pqueue.h"
 #include "ssd_config.h"
@@ -37,6 +38,7 @@ enum io_types {
 	GC_IO = 1,
 	MIGRATE_IO = 2,
 	MAP_READ_IO = 3, // do not use in write operations
+	MAP_WRITE_IO = 4, // dirty map log programs
 };
 
 enum page_status {
@@ -122,6 +124,19 @@ struct nand_cmd {
 	struct ppa ppa;
 	struct list_head entry;
 	uint64_t ctime; // complete time
+	/* plane/lun queue bookkeeping, see cmdq_off() in ssd.c */
+	struct list_head mig_entry; // on nand_cmd_queue.migs if MIGRATE_IO
+	uint64_t qoff;				// queue shifts in front when stime/ctime were set
+	uint64_t shift;				// delay applied to this and later requests
+};
+
+struct nand_cmd_queue {
+	struct list_head cmds; // in execution order
+	struct list_head migs; // MIGRATE_IO requests of @cmds, same order
+	uint64_t base;		   // shifts of popped requests
+	uint64_t total;		   // @base plus the shifts still queued
+	uint64_t depth;
+	uint64_t max_depth;
 };
 
 typedef int nand_sec_status_t;
@@ -149,9 +164,7 @@ struct nand_plane {
 	int nblks;
 #if (BASE_SSD == CONZONE_PROTOTYPE)
 	bool busy;
-	struct list_head cmd_queue_head;
-	uint64_t cmd_queue_depth;
-	uint64_t max_cmd_queue_depth;
+	struct nand_cmd_queue cmdq;
 	bool migrating;
 	uint64_t migrating_etime;
 #endif
@@ -165,9 +178,7 @@ struct nand_lun {
 	uint64_t gc_endtime;
 	bool migrating;
 	uint64_t migrating_etime;
-	struct list_head cmd_queue_head;
-	uint64_t cmd_queue_depth;
-	uint64_t max_cmd_queue_depth;
+	struct nand_cmd_queue cmdq;
 };
 
 struct ssd_channel {
@@ -181,6 +192,12 @@ struct ssd_pcie {
 	struct channel_model *perf_model;
 };
 
+/* open-addressing set of LPNs, kept at most half full */
+struct lpn_set {
+	uint64_t *slots;
+	unsigned int bits;
+};
+
 struct buffer {
 	size_t size;
 	size_t remaining;
@@ -190,6 +207,7 @@ struct buffer {
 	uint64_t tt_lpns;
 	uint64_t *lpns; // for flush
 	uint64_t pgs;	// for flush
+	struct lpn_set lpn_idx; // index of lpns[0..pgs)
 	uint32_t sqid;	// for flush
 	bool busy;
 	size_t flush_data;
@@ -284,14 +302,39 @@ struct ssdparams {
 	uint64_t pslc_blks;
 	uint64_t meta_pslc_blks;
 	uint64_t meta_normal_blks;
+
+	/* precomputed divisors for the per-page PPA and line index math */
+	unsigned long luns_per_group; /* tt_luns / line_groups */
+	unsigned long rows_per_group; /* luns of one channel in a line group */
+	unsigned long pgs_per_stripe; /* pages per wordline across a line */
+	struct reciprocal_value rd_nchs;
+	struct reciprocal_value rd_line_groups;
+	struct reciprocal_value rd_luns_per_group;
+	struct reciprocal_value rd_rows_per_group;
+	struct reciprocal_value rd_pls_per_lun;
+	struct reciprocal_value rd_pgs_per_flashpg;
+	struct reciprocal_value rd_pslc_pgs_per_flashpg;
+	struct reciprocal_value rd_pgs_per_stripe;
+
+	uint64_t l2p_cache_size; // byte
+	int l2p_cache_slots;
+	int l2p_evict_policy;
 #endif
 };
 
+enum {
+	L2P_QUEUE_MAIN = 0, /* LRU list, Am for 2Q */
+	L2P_QUEUE_A1,		/* 2Q probation queue */
+};
+
 struct l2pcache_ent {
 	int nsid;
 	uint64_t lpn;
 	int granularity;
 	int resident;
+	int queue; // L2P_QUEUE_*
+	int ref; // for CLOCK
+	int dirty; // updated since it was loaded
 	int next; // for LRU
 	int last;
 };
@@ -303,6 +346,16 @@ struct l2pcache {
 	int *slot_len;
 	int *tail;
 	int *head;
+	/* 2Q: first-touch entries wait in A1 until they are hit again */
+	int a1_size;
+	int *a1_len;
+	int *a1_tail;
+	int *a1_head;
+	int *hand; // CLOCK hand per slot
+	/* per-namespace partitioning, indexed by nsid */
+	void *owner[NR_NAMESPACES]; // ftl whose l2pcache_idx points into the cache
+	int quota[NR_NAMESPACES];	// max entries per slot, 0: no cap
+	int *ns_len[NR_NAMESPACES];
 	int evict_policy;
 	struct l2pcache_ent **mapping; // only record cached lpns
 };
@@ -314,6 +367,19 @@ struct ssd {
 	struct buffer *write_buffer;
 	unsigned int cpu_nr_dispatcher;
 	struct l2pcache l2pcache;
+
+	/* nand_cmd queued on planes/luns until completion */
+	struct kmem_cache *cmd_cache;
+	uint64_t nr_cmd_allocs;
+	uint64_t nr_cmd_frees;
+
+	/*
+	 * aggregates kept by lun_update/plane_update. migrating_etime is the max
+	 * over all luns ever flagged, an upper bound of the flagged ones only.
+	 */
+	uint64_t next_avail_time; // max next available time of luns/planes
+	uint64_t migrating_etime; // max lun migrating_etime
+	uint32_t nr_migrating;	  // luns flagged migrating
 };
 
 static inline struct ssd_channel *get_ch(struct ssd *ssd, struct ppa *ppa)
@@ -353,6 +419,8 @@ static inline uint32_t get_cell(struct ssd *ssd, struct ppa *ppa)
 
 void ssd_init_params(struct ssdparams *spp, uint64_t capacity, uint32_t nparts);
 void ssd_init(struct ssd *ssd, struct ssdparams *spp, uint32_t cpu_nr_dispatcher);
+struct nand_cmd *ssd_alloc_nand_cmd(struct ssd *ssd);
+void ssd_free_nand_cmd(struct ssd *ssd, struct nand_cmd *cmd);
 void ssd_remove(struct ssd *ssd);
 
 uint64_t ssd_advance_nand(struct ssd *ssd, struct nand_cmd *ncmd);
@@ -364,6 +432,15 @@ void buffer_init(struct buffer *buf, size_t size);
 uint32_t buffer_allocate(struct buffer *buf, size_t size);
 #if (BASE_SSD == CONZONE_PROTOTYPE)
 bool is_buffer_busy(struct buffer *buf);
+void buffer_add_lpn(struct buffer *buf, uint64_t lpn);
+bool buffer_has_lpn(struct buffer *buf, uint64_t lpn);
+void buffer_clear_lpns(struct buffer *buf);
+
+void lpn_set_init(struct lpn_set *set, uint64_t max_lpns);
+void lpn_set_free(struct lpn_set *set);
+void lpn_set_add(struct lpn_set *set, uint64_t lpn);
+bool lpn_set_has(struct lpn_set *set, uint64_t lpn);
+bool lpn_set_del(struct lpn_set *set, uint64_t lpn);
 #endif
 bool buffer_release(struct buffer *buf, size_t size);
 void buffer_refill(struct buffer *buf);
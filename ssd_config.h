@@ -372,15 +372,21 @@ enum wb_strategy {
 enum {
 	L2P_EVICTION_POLICY_NONE, // random evict
 	L2P_EVICTION_POLICY_LRU,
+	L2P_EVICTION_POLICY_2Q, // scan resistant: A1 (probation) + Am (LRU)
+	L2P_EVICTION_POLICY_CLOCK, // approximate LRU, hits only set a reference bit
 };
 
 #define L2P_ENTRY_SIZE (4)							  // 4B
 #define L2P_CACHE_SIZE KB(1020ULL)					  // l2p cache (UFS 4.0 - 1MiB)
 #define L2P_CACHE_HASH_SLOT (3)						  //# of l2p hash slots (3)
 static_assert(((L2P_CACHE_SIZE / L2P_ENTRY_SIZE) % L2P_CACHE_HASH_SLOT) == 0);
-#define L2P_LOG_SIZE (ONESHOT_PAGE_SIZE) /*not used*/ // TODO
+#define L2P_LOG_SIZE (pSLC_ONESHOT_PAGE_SIZE)		  // evicted dirty entries are programmed in units of this
 #define L2P_EVICT_POLICY L2P_EVICTION_POLICY_LRU
+#define L2P_2Q_A1_RATIO (25) // % of a slot kept for the 2Q A1 queue
+#define L2P_NS_QUOTA {0, 0}   // per-nsid cap in % of an l2p slot, 0: no cap
 #define L2P_PREREAD (0)
+#define L2P_STREAM_THRESHOLD (3) // equal-stride map misses before prefetching, 0: off
+#define L2P_STREAM_DEPTH (8)	 // map entries prefetched per stream miss
 #define L2P_HYBRID_MAP 1
 #define L2P_HYBRID_MAP_RESIDENT 1
 
@@ -397,6 +403,20 @@ static const int map_type[] = {ZONE_MAP, SUB_ZONE_MAP, CHUNK_MAP, PAGE_MAP};
 
 #define OP_AREA_PERCENT (0.07)
 
+/* GC victim selection */
+enum {
+	GC_VICTIM_GREEDY,		// fewest valid pages
+	GC_VICTIM_COST_BENEFIT, // max (1 - u) / 2u * age
+	GC_VICTIM_WINDOWED,		// fewest valid pages among the GC_VICTIM_WINDOW coldest lines
+};
+#define GC_VICTIM_POLICY GC_VICTIM_GREEDY
+#define GC_VICTIM_WINDOW (8)
+
+/* Background GC and pSLC migration in device idle gaps */
+#define BG_RECLAIM_IDLE_NS (1000000) // idle time before reclaiming in the gap, 0: off
+#define BG_THRES_LINES_LOW (4)		 // start once free lines drop to this
+#define BG_THRES_LINES_HIGH (8)		 // stop once free lines are back at this
+
 /* For meta area*/
 #define META_WB_SIZE KB(384ULL)
 #define NR_META_WB (1)
@@ -0,0 +1,53 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/* Userspace stand-ins for the kernel helpers channel_model.c uses */
+
+#ifndef _CHMODEL_KSHIM_H
+#define _CHMODEL_KSHIM_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NVMEV_INFO(...)
+#define NVMEV_ERROR(...)
+#define NVMEV_DEBUG(...)
+#define NVMEV_ASSERT(x) \
+	do { \
+		if (!(x)) \
+			abort(); \
+	} while (0)
+
+#define DIV_ROUND_UP(n, d) (((n) + (d)-1) / (d))
+#define min(a, b) ((a) < (b) ? (a) : (b))
+#define MB(x) ((uint64_t)(x) << 20)
+#define NS_PER_SEC(x) ((x)*1000000000ULL)
+
+/* the wall clock is driven by the test */
+extern uint64_t fake_clock;
+
+struct nvmev_config {
+	unsigned int cpu_nr_dispatcher;
+};
+
+struct nvmev_dev {
+	struct nvmev_config config;
+};
+
+extern struct nvmev_dev *nvmev_vdev;
+
+static inline uint64_t cpu_clock(unsigned int cpu)
+{
+	return fake_clock;
+}
+
+static inline void *memchr_inv(const void *s, int c, size_t n)
+{
+	const unsigned char *p = s;
+
+	for (size_t i = 0; i < n; i++)
+		if (p[i] != (unsigned char)c)
+			return (void *)(p + i);
+	return NULL;
+}
+
+#endif
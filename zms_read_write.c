@@ -66,6 +66,15 @@ static inline bool line_reclaimable_without_copy(struct zms_line *line)
 		   line->ipc + line->rpc == line->pgs_per_line;
 }
 
+/* queue a pSLC line for direct erase once it holds no valid page */
+static inline void queue_reclaimable_line(struct zms_ftl *zms_ftl, struct zms_line *line,
+										  int location)
+{
+	if (location == LOC_PSLC && list_empty(&line->reclaim_entry) &&
+		line_reclaimable_without_copy(line))
+		list_add_tail(&line->reclaim_entry, &zms_ftl->lm.pslc_reclaim_list);
+}
+
 static struct zms_line *get_line(struct zms_ftl *zms_ftl, struct ppa *ppa)
 {
 	struct ssdparams *spp = &zms_ftl->ssd->sp;
@@ -83,8 +92,7 @@ static struct zms_line *get_line(struct zms_ftl *zms_ftl, struct ppa *ppa)
 
 	/* 2. Calculate Group ID */
 	int global_die_idx = ppa->zms.lun * spp->nchs + ppa->zms.ch;
-	int dies_per_group = spp->tt_luns / spp->line_groups;
-	int group_id = global_die_idx / dies_per_group;
+	int group_id = reciprocal_divide(global_die_idx, spp->rd_luns_per_group);
 
 	/* 3. Calculate Line ID */
 	lmid = (row_idx * spp->line_groups) + group_id;
@@ -97,7 +105,7 @@ static struct zms_line *get_line(struct zms_ftl *zms_ftl, struct ppa *ppa)
 
 	line = &lm->lines[lmid];
 	if (lm->lines[lmid].sub_lines) {
-		int die_in_group = global_die_idx % dies_per_group;
+		int die_in_group = global_die_idx - group_id * spp->luns_per_group;
 		int sublmid = die_in_group * spp->pls_per_lun + ppa->zms.pl;
 
 		if (sublmid >= spp->blks_per_line) {
@@ -122,13 +130,13 @@ static uint64_t ppa_2_pgidx(struct zms_ftl *zms_ftl, struct ppa *ppa)
 	if (line->parent_id == -1) {
 		uint64_t base = (uint64_t)line->id * line->pgs_per_line;
 
-		int pgs_per_flashpg =
-			(blk->nand_type == CELL_MODE_SLC)
-				? spp->pslc_pgs_per_flashpg
-				: spp->pgs_per_flashpg;
+		bool slc = blk->nand_type == CELL_MODE_SLC;
+		int pgs_per_flashpg = slc ? spp->pslc_pgs_per_flashpg : spp->pgs_per_flashpg;
+		uint32_t flashpg = reciprocal_divide(ppa->zms.pg, slc ? spp->rd_pslc_pgs_per_flashpg
+															   : spp->rd_pgs_per_flashpg);
 
-		int rows_per_line = (spp->tt_luns / spp->line_groups) / spp->nchs;
-		int base_lun = (ppa->zms.lun / rows_per_line) * rows_per_line;
+		int rows_per_line = spp->rows_per_group;
+		int base_lun = reciprocal_divide(ppa->zms.lun, spp->rd_rows_per_group) * rows_per_line;
 		int lun_off = ppa->zms.lun - base_lun;
 
 		uint64_t parallel =
@@ -143,9 +151,9 @@ static uint64_t ppa_2_pgidx(struct zms_ftl *zms_ftl, struct ppa *ppa)
 			spp->pls_per_lun;
 
 		uint64_t off =
-			(ppa->zms.pg / pgs_per_flashpg) * stripe +
+			flashpg * stripe +
 			parallel * pgs_per_flashpg +
-			(ppa->zms.pg % pgs_per_flashpg);
+			(ppa->zms.pg - flashpg * pgs_per_flashpg);
 
 		if (off >= line->pgs_per_line) {
 			NVMEV_ERROR("ppa_2_pgidx overflow line(%d,%d) off %llu line_pgs %lu "
@@ -177,8 +185,8 @@ static uint64_t ppa_2_pgidx(struct zms_ftl *zms_ftl, struct ppa *ppa)
 static bool flashpage_same(struct zms_ftl *zms_ftl, struct ppa ppa1, struct ppa ppa2)
 {
 	struct ssdparams *spp = &zms_ftl->ssd->sp;
-	uint32_t ppa1_page = ppa1.g.pg / spp->pgs_per_flashpg;
-	uint32_t ppa2_page = ppa2.g.pg / spp->pgs_per_flashpg;
+	uint32_t ppa1_page = reciprocal_divide(ppa1.g.pg, spp->rd_pgs_per_flashpg);
+	uint32_t ppa2_page = reciprocal_divide(ppa2.g.pg, spp->rd_pgs_per_flashpg);
 
 	return (ppa1.h.blk_in_ssd == ppa2.h.blk_in_ssd) && (ppa1_page == ppa2_page);
 }
@@ -366,12 +374,10 @@ struct ppa get_first_page(struct zms_ftl *zms_ftl, struct zms_line *line)
 	struct ssdparams *spp = &zms_ftl->ssd->sp;
 	struct ppa ppa;
 	uint64_t group_id, luns_per_group, base_flat_lun, target_flat_lun, plane_offset;
-	if (line->parent_id != -1) {
-		group_id = line->parent_id % spp->line_groups;
-	} else {
-		group_id = line->id % spp->line_groups;
-	}
-	luns_per_group = spp->tt_luns / spp->line_groups;
+	uint32_t lmblk = line->parent_id != -1 ? line->parent_id : line->id;
+
+	group_id = lmblk - reciprocal_divide(lmblk, spp->rd_line_groups) * spp->line_groups;
+	luns_per_group = spp->luns_per_group;
 	base_flat_lun = group_id * luns_per_group;
 	plane_offset = 0;
 
@@ -381,14 +387,16 @@ struct ppa get_first_page(struct zms_ftl *zms_ftl, struct zms_line *line)
 		plane_offset = 0;
 	} else {
 		// Case B: Subline (Specific Block)
-		int offset_within_group = line->id;
-		target_flat_lun = base_flat_lun + (offset_within_group % luns_per_group);
-		plane_offset = (offset_within_group / luns_per_group) % spp->pls_per_lun;
+		uint32_t offset_within_group = line->id;
+		uint32_t lun_round = reciprocal_divide(offset_within_group, spp->rd_luns_per_group);
+		target_flat_lun = base_flat_lun + (offset_within_group - lun_round * luns_per_group);
+		plane_offset =
+			lun_round - reciprocal_divide(lun_round, spp->rd_pls_per_lun) * spp->pls_per_lun;
 	}
 
 	ppa.ppa = 0;
-	ppa.zms.ch = target_flat_lun % spp->nchs;
-	ppa.zms.lun = target_flat_lun / spp->nchs;
+	ppa.zms.lun = reciprocal_divide(target_flat_lun, spp->rd_nchs);
+	ppa.zms.ch = target_flat_lun - ppa.zms.lun * spp->nchs;
 	ppa.zms.pl = plane_offset;
 	ppa.zms.blk = line->blkid;
 	return ppa;
@@ -406,9 +414,10 @@ int lmid_2_blkid(struct zms_ftl *zms_ftl, struct zms_line *line)
 	// Line 1 --> Block 0 (row #1)
 	// Line 2 --> Block 1 (row #0)
 	if (get_namespace_type(zms_ftl->zp.ns_type) == META_NAMESPACE) {
-		blkid = lmblk / spp->line_groups;
+		blkid = reciprocal_divide(lmblk, spp->rd_line_groups);
 	} else {
-		blkid = lmblk / spp->line_groups + spp->meta_normal_blks + spp->meta_pslc_blks;
+		blkid = reciprocal_divide(lmblk, spp->rd_line_groups) + spp->meta_normal_blks +
+				spp->meta_pslc_blks;
 	}
 	return blkid;
 }
@@ -525,7 +534,9 @@ static void print_writebuffer_info(struct zms_ftl *zms_ftl)
 
 static uint64_t submit_nand_cmd(struct ssd *ssd, struct nand_cmd *command)
 {
-	struct nand_cmd *cmd = kmalloc(sizeof(struct nand_cmd), GFP_KERNEL);
+	struct nand_cmd *cmd = ssd_alloc_nand_cmd(ssd);
+	uint64_t nsecs_completed;
+
 	cmd->type = command->type;
 	cmd->cmd = command->cmd;
 	cmd->stime = command->stime;
@@ -534,7 +545,16 @@ static uint64_t submit_nand_cmd(struct ssd *ssd, struct nand_cmd *command)
 	cmd->interleave_pci_dma = command->interleave_pci_dma;
 	cmd->ctime = -1;
 	INIT_LIST_HEAD(&cmd->entry);
-	return ssd_advance_nand(ssd, cmd);
+	INIT_LIST_HEAD(&cmd->mig_entry);
+	cmd->qoff = 0;
+	cmd->shift = 0;
+	nsecs_completed = ssd_advance_nand(ssd, cmd);
+
+	/* NOPs and rejected commands are not queued */
+	if (list_empty(&cmd->entry))
+		ssd_free_nand_cmd(ssd, cmd);
+
+	return nsecs_completed;
 }
 
 static inline void set_l2pcacheidx(struct zms_ftl *zms_ftl, uint64_t lpn, int idx)
@@ -544,7 +564,8 @@ static inline void set_l2pcacheidx(struct zms_ftl *zms_ftl, uint64_t lpn, int id
 					zms_ftl->zp.tt_lpns);
 		return;
 	}
-	zms_ftl->l2pcache_idx[lpn] = idx;
+	/* stored biased by one so a zeroed table means nothing is cached */
+	zms_ftl->l2pcache_idx[lpn] = idx + 1;
 }
 
 static int get_l2pcacheidx(struct zms_ftl *zms_ftl, uint64_t lpn)
@@ -553,68 +574,215 @@ static int get_l2pcacheidx(struct zms_ftl *zms_ftl, uint64_t lpn)
 		NVMEV_ERROR("%s lpn too large %llu / %llu\n", __func__, lpn, zms_ftl->zp.tt_lpns);
 		return -1;
 	}
-	return zms_ftl->l2pcache_idx[lpn];
+	return zms_ftl->l2pcache_idx[lpn] - 1;
+}
+
+static inline int *l2p_qhead(struct l2pcache *cache, uint64_t slot, int q)
+{
+	return q == L2P_QUEUE_A1 ? &cache->a1_head[slot] : &cache->head[slot];
+}
+
+static inline int *l2p_qtail(struct l2pcache *cache, uint64_t slot, int q)
+{
+	return q == L2P_QUEUE_A1 ? &cache->a1_tail[slot] : &cache->tail[slot];
+}
+
+static void l2p_unlink(struct l2pcache *cache, uint64_t slot, int idx)
+{
+	struct l2pcache_ent *ents = cache->mapping[slot];
+	int q = ents[idx].queue;
+
+	if (ents[idx].last == -1)
+		*l2p_qhead(cache, slot, q) = ents[idx].next;
+	else
+		ents[ents[idx].last].next = ents[idx].next;
+
+	if (ents[idx].next == -1)
+		*l2p_qtail(cache, slot, q) = ents[idx].last;
+	else
+		ents[ents[idx].next].last = ents[idx].last;
+
+	if (q == L2P_QUEUE_A1)
+		cache->a1_len[slot]--;
+}
+
+static void l2p_link_tail(struct l2pcache *cache, uint64_t slot, int idx, int q)
+{
+	struct l2pcache_ent *ents = cache->mapping[slot];
+	int *tail = l2p_qtail(cache, slot, q);
+
+	ents[idx].queue = q;
+	ents[idx].last = *tail;
+	ents[idx].next = -1;
+	if (*tail == -1)
+		*l2p_qhead(cache, slot, q) = idx;
+	else
+		ents[*tail].next = idx;
+	*tail = idx;
+
+	if (q == L2P_QUEUE_A1)
+		cache->a1_len[slot]++;
+}
+
+static inline bool l2p_victim_ok(struct l2pcache_ent *ent, int nsid)
+{
+	return !ent->resident && (nsid == -1 || ent->nsid == nsid);
+}
+
+// least recently used non-resident entry of queue q, owned by nsid unless nsid is -1
+static int l2p_find_victim(struct l2pcache *cache, uint64_t slot, int q, int nsid)
+{
+	int idx = *l2p_qhead(cache, slot, q);
+
+	while (idx != -1 && !l2p_victim_ok(&cache->mapping[slot][idx], nsid))
+		idx = cache->mapping[slot][idx].next;
+	return idx;
+}
+
+// a namespace at its quota may only recycle its own entries
+static inline bool l2p_over_quota(struct l2pcache *cache, int nsid, uint64_t slot)
+{
+	return cache->quota[nsid] && cache->ns_len[nsid][slot] >= cache->quota[nsid];
+}
+
+/*
+ * second-chance sweep: clear reference bits until an unreferenced, non-resident entry shows up.
+ * Only [0, slot_len) is in use, a namespace at its quota may sweep a slot that is not full.
+ */
+static int l2p_clock_sweep(struct l2pcache *cache, uint64_t slot, int nsid)
+{
+	struct l2pcache_ent *ents = cache->mapping[slot];
+	int len = cache->slot_len[slot];
+	int hand = cache->hand[slot] < len ? cache->hand[slot] : 0;
+	int evict_idx = -1;
+
+	for (int i = 0; i < 2 * len; i++) {
+		struct l2pcache_ent *ent = &ents[hand];
+		int cur = hand;
+
+		if (++hand == len)
+			hand = 0;
+		if (!l2p_victim_ok(ent, nsid))
+			continue;
+		if (ent->ref) {
+			ent->ref = 0;
+			continue;
+		}
+		evict_idx = cur;
+		break;
+	}
+	cache->hand[slot] = hand;
+	return evict_idx;
+}
+
+// new entries go to A1 under 2Q; resident ones are never evicted, keep them out of A1
+static inline int l2p_new_queue(struct l2pcache *cache, int res)
+{
+	if (cache->evict_policy == L2P_EVICTION_POLICY_2Q && !res)
+		return L2P_QUEUE_A1;
+	return L2P_QUEUE_MAIN;
+}
+
+/*
+ * evicted dirty entries go to the owner's map log, a full log costs one program
+ * on the owner's pSLC frontier. Approximation: the program is timed on the
+ * block the pSLC write pointer is filling but consumes no pSLC page, since map
+ * pages would need GC of their own.
+ */
+static void l2p_log_dirty(struct zms_ftl *zms_ftl, struct zms_ftl *owner)
+{
+	struct ssdparams *spp = &owner->ssd->sp;
+	struct zms_write_pointer *wp = zms_get_wp(owner, USER_IO, LOC_PSLC);
+	struct ppa ppa;
+
+	if (++owner->map_log_len < L2P_LOG_SIZE / L2P_ENTRY_SIZE)
+		return;
+
+	owner->map_log_len = 0;
+	if (!wp->curline)
+		return;
+
+	ppa.ppa = 0;
+	ppa.zms.map = PAGE_MAP;
+	ppa.zms.ch = wp->ch;
+	ppa.zms.lun = wp->lun;
+	ppa.zms.pl = wp->pl;
+	ppa.zms.blk = wp->blk;
+	ppa.zms.pg = wp->pg;
+
+	struct nand_cmd swr = {
+		.type = MAP_WRITE_IO,
+		.cmd = NAND_WRITE,
+		.stime = zms_ftl->current_time,
+		.xfer_size = L2P_LOG_SIZE,
+		.interleave_pci_dma = false,
+		.ppa = ppa,
+	};
+	submit_nand_cmd(owner->ssd, &swr);
+	owner->device_w_pgs += L2P_LOG_SIZE / spp->pgsz;
+	owner->map_w_pgs += L2P_LOG_SIZE / spp->pgsz;
 }
 
 // O(1) access & replace
 // only len==size
 static int l2p_replace(struct zms_ftl *zms_ftl, uint64_t la, int gran, int res)
 {
-	int evict_idx;
+	int evict_idx, old_nsid;
 	struct l2pcache *cache = &zms_ftl->ssd->l2pcache;
 	uint64_t slot = la % cache->num_slots;
+	int nsid = zms_ftl->zp.ns->id;
+	int filter = l2p_over_quota(cache, nsid, slot) ? nsid : -1;
+
 	switch (cache->evict_policy) {
 	case L2P_EVICTION_POLICY_NONE:
 	case L2P_EVICTION_POLICY_LRU:
-		evict_idx = cache->head[slot];
-		while (evict_idx != cache->tail[slot] && cache->mapping[slot][evict_idx].resident) {
-			evict_idx = cache->mapping[slot][evict_idx].next;
-		}
-
-		if (evict_idx == cache->tail[slot] && cache->mapping[slot][evict_idx].resident) {
-			return -1; // no free space to evict
-		}
-		if (evict_idx == cache->tail[slot])
-			break;
-
-		if (evict_idx == cache->head[slot]) {
-			cache->head[slot] = cache->mapping[slot][evict_idx].next;
-			cache->mapping[slot][cache->head[slot]].last = -1;
+		evict_idx = l2p_find_victim(cache, slot, L2P_QUEUE_MAIN, filter);
+		break;
+	case L2P_EVICTION_POLICY_2Q:
+		// drain A1 while it is over its share, so a one-pass scan only recycles A1
+		if (cache->a1_len[slot] > cache->a1_size) {
+			evict_idx = l2p_find_victim(cache, slot, L2P_QUEUE_A1, filter);
+			if (evict_idx == -1)
+				evict_idx = l2p_find_victim(cache, slot, L2P_QUEUE_MAIN, filter);
 		} else {
-			int last = cache->mapping[slot][evict_idx].last;
-			int next = cache->mapping[slot][evict_idx].next;
-			cache->mapping[slot][last].next = next;
-			cache->mapping[slot][next].last = last;
+			evict_idx = l2p_find_victim(cache, slot, L2P_QUEUE_MAIN, filter);
+			if (evict_idx == -1)
+				evict_idx = l2p_find_victim(cache, slot, L2P_QUEUE_A1, filter);
 		}
-
-		cache->mapping[slot][evict_idx].last = cache->tail[slot];
-		cache->mapping[slot][evict_idx].next = -1;
-
-		cache->mapping[slot][cache->tail[slot]].next = evict_idx;
-		cache->tail[slot] = evict_idx;
+		break;
+	case L2P_EVICTION_POLICY_CLOCK:
+		evict_idx = l2p_clock_sweep(cache, slot, filter);
 		break;
 	default:
 		NVMEV_ERROR("Invalid L2P Cache Evict Policy %d\n", cache->evict_policy);
 		return -1;
 	}
 
+	if (evict_idx == -1)
+		return -1; // no free space to evict
+
 	NVMEV_CONZONE_L2P_DEBUG_VERBOSE("Evict L2P cache: lpn %lld gran %d\n",
 									cache->mapping[slot][evict_idx].lpn,
 									cache->mapping[slot][evict_idx].granularity);
-	struct zms_ftl *ftl = zms_ftl;
-	if (cache->mapping[slot][evict_idx].nsid != zms_ftl->zp.ns->id) {
-		struct nvmev_ns *ns = zms_ftl->zp.ns;
-		if (zms_ftl->zp.ns->id == 1)
-			ns--;
-		else
-			ns++;
-		ftl = ns->ftls;
-	}
-	set_l2pcacheidx(ftl, cache->mapping[slot][evict_idx].lpn, -1);
+	old_nsid = cache->mapping[slot][evict_idx].nsid;
+	if (cache->mapping[slot][evict_idx].dirty)
+		l2p_log_dirty(zms_ftl, cache->owner[old_nsid]);
+	set_l2pcacheidx(cache->owner[old_nsid], cache->mapping[slot][evict_idx].lpn, -1);
+	cache->ns_len[old_nsid][slot]--;
+
 	cache->mapping[slot][evict_idx].lpn = la;
 	cache->mapping[slot][evict_idx].granularity = gran;
 	cache->mapping[slot][evict_idx].resident = res;
-	cache->mapping[slot][evict_idx].nsid = zms_ftl->zp.ns->id;
+	cache->mapping[slot][evict_idx].nsid = nsid;
+	cache->ns_len[nsid][slot]++;
+
+	cache->mapping[slot][evict_idx].ref = 0;
+	cache->mapping[slot][evict_idx].dirty = 0;
+
+	if (cache->evict_policy != L2P_EVICTION_POLICY_CLOCK) {
+		l2p_unlink(cache, slot, evict_idx);
+		l2p_link_tail(cache, slot, evict_idx, l2p_new_queue(cache, res));
+	}
 	return evict_idx;
 }
 
@@ -627,22 +795,12 @@ static void l2p_access(struct zms_ftl *zms_ftl, uint64_t la, int idx)
 					cache->head[slot], cache->tail[slot]);
 		return;
 	}
-	if (idx != cache->tail[slot]) {
-		if (idx == cache->head[slot]) {
-			cache->head[slot] = cache->mapping[slot][idx].next;
-			cache->mapping[slot][cache->head[slot]].last = -1;
-		} else {
-			int last = cache->mapping[slot][idx].last;
-			int next = cache->mapping[slot][idx].next;
-			cache->mapping[slot][last].next = next;
-			cache->mapping[slot][next].last = last;
-		}
-
-		cache->mapping[slot][idx].last = cache->tail[slot];
-		cache->mapping[slot][idx].next = -1;
-
-		cache->mapping[slot][cache->tail[slot]].next = idx;
-		cache->tail[slot] = idx;
+	// a hit promotes A1 entries to the main LRU list
+	if (cache->evict_policy == L2P_EVICTION_POLICY_CLOCK) {
+		cache->mapping[slot][idx].ref = 1;
+	} else if (cache->mapping[slot][idx].queue != L2P_QUEUE_MAIN || idx != cache->tail[slot]) {
+		l2p_unlink(cache, slot, idx);
+		l2p_link_tail(cache, slot, idx, L2P_QUEUE_MAIN);
 	}
 	NVMEV_CONZONE_L2P_DEBUG_VERBOSE("L2P Cache Access lpn %lld -> (ns %d la %lld) gran %d res %d\n", la,
 									cache->mapping[slot][idx].nsid,
@@ -657,25 +815,21 @@ static int l2p_insert(struct zms_ftl *zms_ftl, uint64_t la, int gran, int res)
 	NVMEV_CONZONE_L2P_DEBUG_VERBOSE("L2P Cache Insert lpn %lld gran %d res %d\n", la, gran, res);
 	struct l2pcache *cache = &zms_ftl->ssd->l2pcache;
 	uint64_t slot = la % cache->num_slots;
-	if (cache->slot_len[slot] == cache->slot_size)
+	int nsid = zms_ftl->zp.ns->id;
+	if (cache->slot_len[slot] == cache->slot_size || l2p_over_quota(cache, nsid, slot))
 		return l2p_replace(zms_ftl, la, gran, res);
 	int idx = cache->slot_len[slot];
-	int tail = cache->tail[slot];
 
 	cache->mapping[slot][idx].lpn = la;
 	cache->mapping[slot][idx].granularity = gran;
 	cache->mapping[slot][idx].resident = res;
-	cache->mapping[slot][idx].nsid = zms_ftl->zp.ns->id;
+	cache->mapping[slot][idx].nsid = nsid;
+	cache->mapping[slot][idx].ref = 0;
+	cache->mapping[slot][idx].dirty = 0;
+	cache->ns_len[nsid][slot]++;
 
-	cache->mapping[slot][idx].next = -1;
-	if (idx == 0) {
-		cache->mapping[slot][idx].last = -1;
-	} else {
-		cache->mapping[slot][idx].last = tail;
-
-		cache->mapping[slot][tail].next = idx;
-		cache->tail[slot] = idx;
-	}
+	if (cache->evict_policy != L2P_EVICTION_POLICY_CLOCK)
+		l2p_link_tail(cache, slot, idx, l2p_new_queue(cache, res));
 	cache->slot_len[slot]++;
 	return idx;
 }
@@ -716,13 +870,199 @@ static inline void set_rmap_ent(struct zms_ftl *zms_ftl, uint64_t lpn, struct pp
 	zms_ftl->rmap[pgidx] = lpn;
 }
 
+static struct ppa get_advanced_ppa_fast(struct zms_ftl *zms_ftl, struct ppa start_ppa, uint64_t steps);
+
+static inline struct maptbl_leaf *get_maptbl_leaf(struct zms_ftl *zms_ftl, uint64_t lpn)
+{
+	return &zms_ftl->maptbl[lpn >> MAPTBL_LEAF_SHIFT];
+}
+
+/* # of lpns the leaf of lpn covers, the last leaf may be short */
+static inline uint32_t maptbl_leaf_pgs(struct zms_ftl *zms_ftl, uint64_t lpn)
+{
+	uint64_t base = lpn & ~((uint64_t)MAPTBL_LEAF_PGS - 1);
+	return min_t(uint64_t, MAPTBL_LEAF_PGS, zms_ftl->zp.tt_lpns - base);
+}
+
+/* entry off of the run, following start the way nextpage() walks a line */
+static struct ppa maptbl_run_ent(struct zms_ftl *zms_ftl, struct maptbl_leaf *leaf, uint32_t off)
+{
+	struct ppa ppa = leaf->start;
+
+	if (off == leaf->sidx)
+		return ppa;
+	ppa.zms.map = PAGE_MAP;
+	return get_advanced_ppa_fast(zms_ftl, ppa, off - leaf->sidx);
+}
+
+static struct ppa maptbl_leaf_ent(struct zms_ftl *zms_ftl, struct maptbl_leaf *leaf, uint32_t off)
+{
+	struct ppa ppa;
+
+	if (leaf->pages)
+		return leaf->pages[off];
+
+	if (off >= leaf->skip && off < leaf->len)
+		return maptbl_run_ent(zms_ftl, leaf, off);
+
+	if (off >= leaf->len && leaf->tail_rsv)
+		ppa = RSV_PPA;
+	else
+		ppa.ppa = UNMAPPED_PPA;
+	return ppa;
+}
+
+static void maptbl_leaf_reset(struct zms_ftl *zms_ftl, struct maptbl_leaf *leaf)
+{
+	if (leaf->pages) {
+		kfree(leaf->pages);
+		zms_ftl->maptbl_expanded--;
+	}
+	leaf->pages = NULL;
+	leaf->sidx = 0;
+	leaf->skip = 0;
+	leaf->len = 0;
+	leaf->nr_used = 0;
+	leaf->tail_rsv = false;
+}
+
+/*
+ * Callers have already committed the update (flash programmed, rmap set), so
+ * the expansion must not fail: the array is a single page, which __GFP_NOFAIL
+ * keeps retrying for instead of dropping the mapping.
+ */
+static void maptbl_leaf_expand(struct zms_ftl *zms_ftl, struct maptbl_leaf *leaf, uint32_t pgs)
+{
+	struct ppa *pages =
+		kmalloc_array(MAPTBL_LEAF_PGS, sizeof(struct ppa), GFP_KERNEL | __GFP_NOFAIL);
+
+	leaf->nr_used = 0;
+	for (uint32_t i = 0; i < MAPTBL_LEAF_PGS; i++) {
+		pages[i].ppa = UNMAPPED_PPA;
+		if (i < pgs)
+			pages[i] = maptbl_leaf_ent(zms_ftl, leaf, i);
+		if (pages[i].ppa != UNMAPPED_PPA)
+			leaf->nr_used++;
+	}
+	leaf->pages = pages;
+	zms_ftl->maptbl_expanded++;
+}
+
+/*
+ * Try to apply maptbl[off] = ppa without leaving the extent form. Covers what
+ * coarse mappings do: a run growing page by page from a reservation, set_map_gran
+ * retagging its head entry, and trims/resets walking it front to back.
+ */
+static bool maptbl_extent_update(struct zms_ftl *zms_ftl, struct maptbl_leaf *leaf, uint32_t off,
+								 struct ppa ppa, uint32_t pgs)
+{
+	bool run_empty = (leaf->skip == leaf->len);
+
+	if (ppa.ppa == UNMAPPED_PPA) {
+		if (off != leaf->skip)
+			return false;
+		if (off < leaf->len)
+			leaf->skip++;
+		else if (run_empty && leaf->tail_rsv)
+			leaf->skip = leaf->len = off + 1;
+		else
+			return false;
+
+		if (leaf->skip == leaf->len && (!leaf->tail_rsv || leaf->len >= pgs))
+			maptbl_leaf_reset(zms_ftl, leaf);
+		return true;
+	}
+
+	if (IS_RSV_PPA(ppa))
+		return false;
+
+	if (run_empty && (off == leaf->len || !leaf->tail_rsv)) {
+		leaf->start = ppa;
+		leaf->sidx = off;
+		leaf->skip = off;
+		leaf->len = off + 1;
+		return true;
+	}
+
+	if (!run_empty && off == leaf->len) {
+		if (maptbl_run_ent(zms_ftl, leaf, off).ppa != ppa.ppa)
+			return false;
+		leaf->len++;
+		return true;
+	}
+
+	if (off == leaf->sidx && off == leaf->skip && off < leaf->len) {
+		struct ppa cur = leaf->start;
+
+		cur.zms.map = ppa.zms.map;
+		if (cur.ppa == ppa.ppa) {
+			leaf->start = ppa;
+			return true;
+		}
+	}
+	return false;
+}
+
 static inline void set_maptbl_ent(struct zms_ftl *zms_ftl, uint64_t lpn, struct ppa *ppa)
 {
 	if (lpn >= zms_ftl->zp.tt_lpns) {
 		NVMEV_ERROR("%s lpn too large %llu / %llu\n", __func__, lpn, zms_ftl->zp.tt_lpns);
 		return;
 	}
-	zms_ftl->maptbl[lpn] = *ppa;
+
+	struct maptbl_leaf *leaf = get_maptbl_leaf(zms_ftl, lpn);
+	uint32_t off = lpn & (MAPTBL_LEAF_PGS - 1);
+	uint32_t pgs = maptbl_leaf_pgs(zms_ftl, lpn);
+	struct ppa cur = maptbl_leaf_ent(zms_ftl, leaf, off);
+
+	if (cur.ppa == ppa->ppa)
+		return;
+
+	if (!leaf->pages) {
+		if (maptbl_extent_update(zms_ftl, leaf, off, *ppa, pgs))
+			return;
+		maptbl_leaf_expand(zms_ftl, leaf, pgs);
+	}
+
+	if (cur.ppa == UNMAPPED_PPA)
+		leaf->nr_used++;
+	else if (ppa->ppa == UNMAPPED_PPA)
+		leaf->nr_used--;
+	leaf->pages[off] = *ppa;
+
+	if (leaf->nr_used == 0)
+		maptbl_leaf_reset(zms_ftl, leaf);
+}
+
+static inline void clear_maptbl_ent(struct zms_ftl *zms_ftl, uint64_t lpn)
+{
+	struct ppa ppa = {.ppa = UNMAPPED_PPA};
+
+	set_maptbl_ent(zms_ftl, lpn, &ppa);
+}
+
+/* maptbl[slpn, slpn + pgs) = RSV_PPA, an unmapped leaf reserved up to its end stays an extent */
+static void reserve_maptbl_range(struct zms_ftl *zms_ftl, uint64_t slpn, uint64_t pgs)
+{
+	struct ppa rsv = RSV_PPA;
+	uint64_t elpn = min_t(uint64_t, slpn + pgs, zms_ftl->zp.tt_lpns);
+	uint64_t lpn = slpn;
+
+	while (lpn < elpn) {
+		struct maptbl_leaf *leaf = get_maptbl_leaf(zms_ftl, lpn);
+		uint32_t off = lpn & (MAPTBL_LEAF_PGS - 1);
+		uint64_t leaf_elpn = lpn - off + maptbl_leaf_pgs(zms_ftl, lpn);
+
+		if (elpn >= leaf_elpn && !leaf->pages && leaf->skip == leaf->len && !leaf->tail_rsv) {
+			leaf->skip = off;
+			leaf->len = off;
+			leaf->tail_rsv = true;
+			lpn = leaf_elpn;
+			continue;
+		}
+		set_maptbl_ent(zms_ftl, lpn, &rsv);
+		lpn++;
+	}
 }
 
 struct ppa get_maptbl_ent(struct zms_ftl *zms_ftl, uint64_t lpn)
@@ -733,7 +1073,7 @@ struct ppa get_maptbl_ent(struct zms_ftl *zms_ftl, uint64_t lpn)
 		ppa.ppa = UNMAPPED_PPA;
 		return ppa;
 	}
-	return zms_ftl->maptbl[lpn];
+	return maptbl_leaf_ent(zms_ftl, get_maptbl_leaf(zms_ftl, lpn), lpn & (MAPTBL_LEAF_PGS - 1));
 }
 
 static struct ppa get_prev_ppa(struct zms_ftl *zms_ftl, uint64_t lpn, int granularity)
@@ -744,58 +1084,42 @@ static struct ppa get_prev_ppa(struct zms_ftl *zms_ftl, uint64_t lpn, int granul
 	return ppa;
 }
 
-static bool check_migrating(struct zms_ftl *zms_ftl)
+/* is some lun flagged migrating until after t */
+static bool luns_migrating_after(struct zms_ftl *zms_ftl, uint64_t t)
 {
 	struct ssd *ssd = zms_ftl->ssd;
 	struct ssdparams *spp = &ssd->sp;
 	struct ppa ppa;
-	struct zms_line *sblk_line;
 	int lun, ch;
+
+	// common case: nothing flagged, or no migration at all ends after t
+	if (!ssd->nr_migrating || ssd->migrating_etime <= t)
+		return 0;
+
+	ppa.ppa = 0;
 	for (lun = 0; lun < spp->luns_per_ch; lun++) {
 		for (ch = 0; ch < spp->nchs; ch++) {
 			struct nand_lun *lunp;
 
 			ppa.g.ch = ch;
 			ppa.g.lun = lun;
-			ppa.g.pl = 0;
-			lunp = get_lun(zms_ftl->ssd, &ppa);
-			if (lunp->migrating && lunp->migrating_etime > zms_ftl->current_time)
+			lunp = get_lun(ssd, &ppa);
+			if (lunp->migrating && lunp->migrating_etime > t)
 				return 1;
 		}
 	}
 	return 0;
 }
 
-static uint64_t check_maxfreetime(struct zms_ftl *zms_ftl)
+static bool check_migrating(struct zms_ftl *zms_ftl)
 {
-	struct ssd *ssd = zms_ftl->ssd;
-	struct ssdparams *spp = &ssd->sp;
-	struct ppa ppa;
-	ppa.ppa = 0;
-
-	uint64_t max_freetime = 0;
-	int lun, ch;
-	for (lun = 0; lun < spp->luns_per_ch; lun++) {
-		for (ch = 0; ch < spp->nchs; ch++) {
-			ppa.g.ch = ch;
-			ppa.g.lun = lun;
-			ppa.g.pl = 0;
+	return luns_migrating_after(zms_ftl, zms_ftl->current_time);
+}
 
-			struct nand_lun *lunp = get_lun(ssd, &ppa);
-			struct nand_cmd gcw = {
-				.type = GC_IO,
-				.cmd = NAND_NOP,
-				.stime = 0,
-				.interleave_pci_dma = false,
-				.ppa = ppa,
-			};
-			NVMEV_CONZONE_PRINT_TIME("nsid [%d] submit nand cmd in %s\n", zms_ftl->zp.ns->id,
-									 __func__);
-			uint64_t end_time = submit_nand_cmd(zms_ftl->ssd, &gcw);
-			max_freetime = max(max_freetime, (end_time - zms_ftl->current_time));
-		}
-	}
-	return max_freetime;
+/* the time at which the last busy plane frees up, i.e. since when the device is idle */
+static uint64_t check_maxfreetime(struct zms_ftl *zms_ftl)
+{
+	return zms_ftl->ssd->next_avail_time;
 }
 
 static int get_aggidx(struct zms_ftl *zms_ftl, uint64_t lpn)
@@ -805,6 +1129,15 @@ static int get_aggidx(struct zms_ftl *zms_ftl, uint64_t lpn)
 			   : 0;
 }
 
+static void zone_agg_reset(struct zms_ftl *zms_ftl, int agg_idx)
+{
+	if (zms_ftl->zone_agg_set.slots) {
+		for (int i = 0; i < zms_ftl->zone_agg_pgs[agg_idx]; i++)
+			lpn_set_del(&zms_ftl->zone_agg_set, zms_ftl->zone_agg_lpns[agg_idx][i]);
+	}
+	zms_ftl->zone_agg_pgs[agg_idx] = 0;
+}
+
 struct ppa get_current_page(struct zms_ftl *zms_ftl, struct zms_write_pointer *wp)
 {
 	struct ppa ppa;
@@ -895,12 +1228,12 @@ static void nextpage_interleave(struct zms_ftl *zms_ftl, struct ppa *ppa)
 		return;
 	struct ssdparams *spp = &zms_ftl->ssd->sp;
 	struct nand_block *blk = get_blk(zms_ftl->ssd, ppa);
-	int rows_per_line = (spp->tt_luns / spp->line_groups) / spp->nchs;
+	int rows_per_line = spp->rows_per_group;
 	int pgs_per_flashpg = spp->pgs_per_flashpg;
 
 	check_addr(ppa->zms.pg, blk->used_pgs);
 	ppa->zms.pg++;
-	if ((ppa->zms.pg % pgs_per_flashpg) != 0)
+	if (ppa->zms.pg != reciprocal_divide(ppa->zms.pg, spp->rd_pgs_per_flashpg) * pgs_per_flashpg)
 		goto out;
 
 	ppa->zms.pg -= pgs_per_flashpg;
@@ -919,7 +1252,7 @@ static void nextpage_interleave(struct zms_ftl *zms_ftl, struct ppa *ppa)
 	ppa->zms.ch = 0;
 
 	int current_lun_idx = ppa->zms.lun;
-	int base_lun = (current_lun_idx / rows_per_line) * rows_per_line;
+	int base_lun = reciprocal_divide(current_lun_idx, spp->rd_rows_per_group) * rows_per_line;
 	int max_lun_for_this_line = base_lun + rows_per_line;
 
 	check_addr(ppa->zms.lun, spp->luns_per_ch);
@@ -1056,27 +1389,28 @@ static struct ppa get_advanced_ppa_fast(struct zms_ftl *zms_ftl, struct ppa star
 	int D_PG_LOW = pgs_per_flashpg;
 	int D_PL = spp->pls_per_lun;
 	int D_CH = spp->nchs;
-	int rows_per_line = (spp->tt_luns / spp->line_groups) / spp->nchs;
+	int rows_per_line = spp->rows_per_group;
 	int D_LUN = rows_per_line;
 
-	int cur_pg_low = start_ppa.zms.pg % D_PG_LOW;
-	int cur_pg_high = start_ppa.zms.pg / D_PG_LOW;
+	int cur_pg_high = reciprocal_divide(start_ppa.zms.pg, spp->rd_pgs_per_flashpg);
+	int cur_pg_low = start_ppa.zms.pg - cur_pg_high * D_PG_LOW;
 	int cur_pl = start_ppa.zms.pl;
 	int cur_ch = start_ppa.zms.ch;
 
 	int current_lun_idx = start_ppa.zms.lun;
-	int base_lun = (current_lun_idx / rows_per_line) * rows_per_line;
+	int base_lun = reciprocal_divide(current_lun_idx, spp->rd_rows_per_group) * rows_per_line;
 	int cur_lun_offset = current_lun_idx - base_lun;
 
-	uint64_t stripe_size = (uint64_t)D_PG_LOW * D_PL * D_CH * D_LUN;
+	uint64_t stripe_size = spp->pgs_per_stripe;
 
 	uint64_t current_idx_in_stripe =
 		(uint64_t)cur_pg_low + (uint64_t)cur_pl * D_PG_LOW + (uint64_t)cur_ch * D_PL * D_PG_LOW + (uint64_t)cur_lun_offset * D_CH * D_PL * D_PG_LOW;
 
 	uint64_t total_steps_in_stripe = current_idx_in_stripe + steps;
 
-	uint64_t stripes_advanced = total_steps_in_stripe / stripe_size; // Wordline id
-	uint64_t new_idx_in_stripe = total_steps_in_stripe % stripe_size;
+	uint64_t stripes_advanced =
+		reciprocal_divide(total_steps_in_stripe, spp->rd_pgs_per_stripe); // Wordline id
+	uint64_t new_idx_in_stripe = total_steps_in_stripe - stripes_advanced * stripe_size;
 
 	int new_pg_high = cur_pg_high + stripes_advanced;
 
@@ -1085,16 +1419,19 @@ static struct ppa get_advanced_ppa_fast(struct zms_ftl *zms_ftl, struct ppa star
 		return next;
 	}
 
-	uint64_t rem = new_idx_in_stripe;
+	uint32_t rem = new_idx_in_stripe, q;
 
-	int new_pg_low = rem % D_PG_LOW;
-	rem /= D_PG_LOW;
+	q = reciprocal_divide(rem, spp->rd_pgs_per_flashpg);
+	int new_pg_low = rem - q * D_PG_LOW;
+	rem = q;
 
-	int new_pl = rem % D_PL;
-	rem /= D_PL;
+	q = reciprocal_divide(rem, spp->rd_pls_per_lun);
+	int new_pl = rem - q * D_PL;
+	rem = q;
 
-	int new_ch = rem % D_CH;
-	rem /= D_CH;
+	q = reciprocal_divide(rem, spp->rd_nchs);
+	int new_ch = rem - q * D_CH;
+	rem = q;
 
 	int new_lun_offset = rem;
 
@@ -1229,6 +1566,7 @@ static void mark_page_invalid(struct zms_ftl *zms_ftl, struct ppa *ppa)
 		was_full_line = true;
 	}
 	line->ipc++;
+	line->inv_time = zms_ftl->current_time;
 	if (!(line->vpc > 0 && line->vpc <= line->pgs_per_line)) {
 		NVMEV_ERROR("[I] line id %d vpc %d pgs_per_line %lu\n", line->id, line->vpc,
 					line->pgs_per_line);
@@ -1252,6 +1590,8 @@ static void mark_page_invalid(struct zms_ftl *zms_ftl, struct ppa *ppa)
 		pqueue_insert(victim_pq, line);
 		inc_victim_cnt(zms_ftl, location);
 	}
+
+	queue_reclaimable_line(zms_ftl, line, location);
 }
 
 static void mark_block_free(struct zms_ftl *zms_ftl, struct ppa *ppa)
@@ -1299,16 +1639,19 @@ static void set_map_gran(struct zms_ftl *zms_ftl, int gran, uint64_t map_slpn)
 	int is_resident = check_resident(zms_ftl, gran);
 	struct ppa ppa = get_maptbl_ent(zms_ftl, map_slpn);
 	int cache_idx = get_l2pcacheidx(zms_ftl, map_slpn);
+	struct l2pcache *cache = &zms_ftl->ssd->l2pcache;
+	uint64_t slot = map_slpn % cache->num_slots;
 
 	if (cache_idx == -1) {
 		cache_idx = l2p_insert(zms_ftl, map_slpn, gran, is_resident);
 		set_l2pcacheidx(zms_ftl, map_slpn, cache_idx);
 	} else {
-		struct l2pcache *cache = &zms_ftl->ssd->l2pcache;
-		uint64_t slot = map_slpn % cache->num_slots;
 		cache->mapping[slot][cache_idx].granularity = gran;
 		cache->mapping[slot][cache_idx].resident = is_resident;
 	}
+	// the new mapping has to reach flash once the entry leaves the cache
+	if (cache_idx != -1)
+		cache->mapping[slot][cache_idx].dirty = 1;
 
 	ppa.zms.map = gran;
 	set_maptbl_ent(zms_ftl, map_slpn, &ppa);
@@ -1340,6 +1683,60 @@ static inline bool should_migrate_low(struct zms_ftl *zms_ftl)
 	return zms_ftl->lm.pslc_free_line_cnt <= zms_ftl->zp.migrate_thres_lines_low;
 }
 
+/*
+ * The victim pqueue stays ordered by vpc, which is what greedy needs and what
+ * mark_page_invalid maintains. Age-aware policies scan its heap array instead,
+ * since their score changes with time and cannot be kept in the heap.
+ */
+static struct zms_line *victim_cost_benefit(struct zms_ftl *zms_ftl, pqueue_t *victim_pq)
+{
+	struct zms_line *victim_line = NULL;
+	uint64_t best = 0;
+
+	for (size_t i = 1; i < victim_pq->size; i++) {
+		struct zms_line *line = victim_pq->d[i];
+		uint64_t now = max(zms_ftl->current_time, line->inv_time);
+		uint64_t age = (now - line->inv_time) / 1000 + 1; // us
+		uint64_t score;
+
+		if (line->vpc == 0)
+			return line;
+		// (1 - u) / 2u * age, with u = vpc / pgs_per_line
+		score = (line->pgs_per_line - line->vpc) * age / (2 * line->vpc);
+		if (!victim_line || score > best) {
+			victim_line = line;
+			best = score;
+		}
+	}
+	return victim_line;
+}
+
+static struct zms_line *victim_windowed(struct zms_ftl *zms_ftl, pqueue_t *victim_pq)
+{
+	struct zms_line *window[GC_VICTIM_WINDOW];
+	struct zms_line *victim_line = NULL;
+	int len = 0;
+
+	// keep the GC_VICTIM_WINDOW lines invalidated longest ago, oldest first
+	for (size_t i = 1; i < victim_pq->size; i++) {
+		struct zms_line *line = victim_pq->d[i];
+		int j = len < GC_VICTIM_WINDOW ? len++ : GC_VICTIM_WINDOW;
+
+		for (; j > 0 && window[j - 1]->inv_time > line->inv_time; j--) {
+			if (j < GC_VICTIM_WINDOW)
+				window[j] = window[j - 1];
+		}
+		if (j < GC_VICTIM_WINDOW)
+			window[j] = line;
+	}
+
+	for (int i = 0; i < len; i++) {
+		if (!victim_line || window[i]->vpc < victim_line->vpc)
+			victim_line = window[i];
+	}
+	return victim_line;
+}
+
 static struct zms_line *select_victim_line(struct zms_ftl *zms_ftl, bool force, int location)
 {
 	struct ssdparams *spp = &zms_ftl->ssd->sp;
@@ -1351,11 +1748,16 @@ static struct zms_line *select_victim_line(struct zms_ftl *zms_ftl, bool force,
 		return NULL;
 	}
 
+	if (zpp->gc_victim_policy == GC_VICTIM_COST_BENEFIT)
+		victim_line = victim_cost_benefit(zms_ftl, victim_pq);
+	else if (zpp->gc_victim_policy == GC_VICTIM_WINDOWED)
+		victim_line = victim_windowed(zms_ftl, victim_pq);
+
 	if (!force && (victim_line->vpc > (spp->pgs_per_line / 8))) {
 		return NULL;
 	}
 
-	pqueue_pop(victim_pq);
+	pqueue_remove(victim_pq, victim_line);
 	victim_line->pos = 0;
 	dec_victim_cnt(zms_ftl, location);
 	/* victim_line is a danggling node now */
@@ -1404,6 +1806,7 @@ static void mark_line_free(struct zms_ftl *zms_ftl, struct zms_line *line, int i
 		}
 	}
 
+	list_del_init(&line->reclaim_entry);
 	line->ipc = 0;
 	line->vpc = 0;
 	line->rpc = 0;
@@ -1462,7 +1865,7 @@ static void mark_line_free(struct zms_ftl *zms_ftl, struct zms_line *line, int i
 }
 
 static void foreground_gc(struct zms_ftl *zms_ftl, int location);
-static void try_migrate(struct zms_ftl *zms_ftl);
+static void try_migrate(struct zms_ftl *zms_ftl, bool background);
 
 static inline void check_and_refill_write_credit(struct zms_ftl *zms_ftl, int location)
 {
@@ -1497,7 +1900,7 @@ static int update_mapping_if_reserved(struct zms_ftl *zms_ftl, uint64_t lpn, int
 		return FAILURE;
 	}
 
-	if (!IS_RSV_PPA(zms_ftl->maptbl[lpn])) {
+	if (!IS_RSV_PPA(get_maptbl_ent(zms_ftl, lpn))) {
 		NVMEV_ERROR("current lpn %lld not reserved, prev ppa: ch %d lun %d pl %d blk %d pg %d\n", lpn, ppa.zms.ch, ppa.zms.lun, ppa.zms.pl, ppa.zms.blk, ppa.zms.pg);
 		return FAILURE;
 	}
@@ -1596,8 +1999,8 @@ static void update_or_reserve_mapping(struct zms_ftl *zms_ftl, uint64_t lpn, int
 							slpn + i, loc, io_type, old.zms.ch, old.zms.lun, old.zms.pl,
 							old.zms.blk, old.zms.pg);
 			}
-			zms_ftl->maptbl[slpn + i] = RSV_PPA;
 		}
+		reserve_maptbl_range(zms_ftl, slpn, pgs);
 
 		// get current new page
 		ppa = get_new_page(zms_ftl, io_type, loc); // MAP_RSV bit is cleared in new ppa
@@ -1663,6 +2066,8 @@ static void update_or_reserve_mapping(struct zms_ftl *zms_ftl, uint64_t lpn, int
 			struct ppa next_ppa = get_advanced_ppa_fast(zms_ftl, ppa, step);
 
 			current_line->rpc += step;
+			queue_reclaimable_line(zms_ftl, current_line,
+								   get_line_location(zms_ftl, current_line));
 
 			if (mapped_ppa(&next_ppa)) {
 				update_write_pointer(wpp, next_ppa);
@@ -1771,7 +2176,7 @@ static uint64_t nand_write(struct zms_ftl *zms_ftl, uint64_t nsecs_start, uint64
 				consume_write_credit(zms_ftl, location);
 				check_and_refill_write_credit(zms_ftl, location);
 			} else {
-				try_migrate(zms_ftl);
+				try_migrate(zms_ftl, false);
 			}
 		}
 	}
@@ -1932,7 +2337,7 @@ static uint64_t internal_write(struct zms_ftl *zms_ftl, uint64_t *write_lpns, in
 
 			mark_page_invalid(zms_ftl, &ppa);
 			set_rmap_ent(zms_ftl, INVALID_LPN, &ppa);
-			zms_ftl->maptbl[lpn].ppa = UNMAPPED_PPA;
+			clear_maptbl_ent(zms_ftl, lpn);
 
 		} else {
 			if (io_type != USER_IO && !(io_type == GC_IO && dest_loc == LOC_NORMAL)) {
@@ -1984,6 +2389,7 @@ static void submit_internal_write(struct zms_ftl *zms_ftl, struct zms_line *line
 		if (dest_loc == LOC_NORMAL) {
 			for (int i = 0; i < zms_ftl->gc_agg_len; i++) {
 				agg_lpns[i] = zms_ftl->gc_agg_lpns[i];
+				lpn_set_del(&zms_ftl->gc_agg_set, agg_lpns[i]);
 			}
 			agg_len = zms_ftl->gc_agg_len;
 			zms_ftl->gc_agg_len = 0;
@@ -2030,6 +2436,7 @@ static void submit_internal_write(struct zms_ftl *zms_ftl, struct zms_line *line
 				}
 
 				agg_lpns[agg_len] = lpn;
+				lpn_set_add(&zms_ftl->zone_agg_set, lpn);
 				zms_ftl->zone_agg_pgs[agg_idx]++;
 				agg_len++;
 
@@ -2039,9 +2446,9 @@ static void submit_internal_write(struct zms_ftl *zms_ftl, struct zms_line *line
 			}
 
 			if (agg_len == pgs_per_oneshotpg) {
-				internal_write(zms_ftl, agg_lpns, 0, agg_len, io_type, dest_loc, 0);
+				internal_write(zms_ftl, agg_lpns, 0, agg_len, io_type, dest_loc, zms_ftl->bg_stime);
 				if (io_type == MIGRATE_IO) {
-					zms_ftl->zone_agg_pgs[agg_idx] = 0;
+					zone_agg_reset(zms_ftl, agg_idx);
 				}
 				agg_len = 0;
 			}
@@ -2080,7 +2487,8 @@ static void submit_internal_write(struct zms_ftl *zms_ftl, struct zms_line *line
 					}
 
 					if (agg_len == spp->pslc_pgs_per_oneshotpg) {
-						internal_write(zms_ftl, agg_lpns, 0, agg_len, io_type, LOC_PSLC, 0);
+						internal_write(zms_ftl, agg_lpns, 0, agg_len, io_type,
+									   LOC_PSLC, zms_ftl->bg_stime);
 						agg_len = 0;
 					}
 				}
@@ -2108,13 +2516,14 @@ static void submit_internal_write(struct zms_ftl *zms_ftl, struct zms_line *line
 				int len = zms_ftl->gc_agg_len;
 				zms_ftl->gc_agg_lpns[len] = lpn;
 				zms_ftl->gc_agg_len++;
+				lpn_set_add(&zms_ftl->gc_agg_set, lpn);
 
 				ppa = get_maptbl_ent(zms_ftl, lpn);
 
 				if (mapped_ppa(&ppa)) {
 					mark_page_invalid(zms_ftl, &ppa);
 					set_rmap_ent(zms_ftl, INVALID_LPN, &ppa);
-					zms_ftl->maptbl[lpn].ppa = UNMAPPED_PPA;
+					clear_maptbl_ent(zms_ftl, lpn);
 				} else {
 					NVMEV_ERROR("BAD AGG IN GC!!: ppa unmapped!\n");
 					// NVMEV_ASSERT(0);
@@ -2122,7 +2531,7 @@ static void submit_internal_write(struct zms_ftl *zms_ftl, struct zms_line *line
 			}
 
 		} else {
-			internal_write(zms_ftl, agg_lpns, 0, agg_len, io_type, LOC_PSLC, 0);
+			internal_write(zms_ftl, agg_lpns, 0, agg_len, io_type, LOC_PSLC, zms_ftl->bg_stime);
 		}
 	}
 	kfree(agg_lpns);
@@ -2161,7 +2570,7 @@ static void erase_line(struct zms_ftl *zms_ftl, struct zms_line *line, int io_ty
 						struct nand_cmd ecmd = {
 							.type = io_type,
 							.cmd = NAND_ERASE,
-							.stime = 0,
+							.stime = zms_ftl->bg_stime,
 							.interleave_pci_dma = false,
 							.ppa = e_ppa,
 						};
@@ -2178,7 +2587,7 @@ static void erase_line(struct zms_ftl *zms_ftl, struct zms_line *line, int io_ty
 			struct nand_cmd ecmd = {
 				.type = io_type,
 				.cmd = NAND_ERASE,
-				.stime = 0,
+				.stime = zms_ftl->bg_stime,
 				.interleave_pci_dma = false,
 				.ppa = e_ppa,
 			};
@@ -2313,6 +2722,7 @@ static struct zms_line *do_migrate_simple(struct zms_ftl *zms_ftl, int io_type)
 				// NVMEV_ASSERT(0);
 			}
 			agg_lpns[agg_len] = lpn;
+			lpn_set_add(&zms_ftl->zone_agg_set, lpn);
 			zms_ftl->zone_agg_pgs[agg_idx]++;
 			agg_len++;
 			zms_ftl->device_copy_pgs++;
@@ -2327,7 +2737,9 @@ static struct zms_line *do_migrate_simple(struct zms_ftl *zms_ftl, int io_type)
 						   agg_len, zms_ftl->zone_agg_pgs[agg_idx], unaligned);
 	if (write_len) {
 		NVMEV_CONZONE_GC_DEBUG("simple migrate: migrate idx %d, %lld\n", 0, write_len);
-		internal_write(zms_ftl, agg_lpns, 0, write_len, io_type, LOC_NORMAL, 0);
+		internal_write(zms_ftl, agg_lpns, 0, write_len, io_type, LOC_NORMAL, zms_ftl->bg_stime);
+		for (int i = 0; i < write_len; i++)
+			lpn_set_del(&zms_ftl->zone_agg_set, agg_lpns[i]);
 	}
 
 	if (unaligned) {
@@ -2335,7 +2747,8 @@ static struct zms_line *do_migrate_simple(struct zms_ftl *zms_ftl, int io_type)
 		NVMEV_CONZONE_GC_DEBUG("simple migrate: migrate unaligned idx %lld, %d\n", unaligned_sidx,
 							   agg_len);
 		if (zms_ftl->zone_agg_pgs[agg_idx]) {
-			internal_write(zms_ftl, agg_lpns, unaligned_sidx, agg_len, io_type, LOC_PSLC, 0);
+			internal_write(zms_ftl, agg_lpns, unaligned_sidx, agg_len, io_type,
+						   LOC_PSLC, zms_ftl->bg_stime);
 
 			for (int i = 0, j = unaligned_sidx; j < agg_len; i++, j++) {
 				zms_ftl->zone_agg_lpns[agg_idx][i] = zms_ftl->zone_agg_lpns[agg_idx][j];
@@ -2353,9 +2766,9 @@ static struct zms_line *do_migrate_simple(struct zms_ftl *zms_ftl, int io_type)
 	return sblk_line;
 }
 
-static void try_migrate(struct zms_ftl *zms_ftl)
+static void try_migrate(struct zms_ftl *zms_ftl, bool background)
 {
-	if (!SLC_BYPASS && should_migrate_low(zms_ftl)) {
+	if (!SLC_BYPASS && (background || should_migrate_low(zms_ftl))) {
 		struct ppa ppa;
 		struct zms_line *sblk_line = NULL;
 		int direct_erase = 0;
@@ -2365,29 +2778,19 @@ static void try_migrate(struct zms_ftl *zms_ftl)
 		// io type == USER IO, so if the erased lines are in victim_pq or migrat_pq, they will be
 		// removed from them.
 		struct zms_line_mgmt *lm = &zms_ftl->lm;
-		for (int i = 0; i < lm->tt_lines; i++) {
-			if (lm->lines[i].sub_lines) {
-				for (int j = 0; j < zms_ftl->ssd->sp.blks_per_line; j++) {
-					if (get_line_location(zms_ftl, &lm->lines[i].sub_lines[j]) == LOC_PSLC &&
-						line_reclaimable_without_copy(&lm->lines[i].sub_lines[j])) {
-						NVMEV_CONZONE_GC_DEBUG(
-							"try direct earse line %d parent id %d pgs per line %ld\n", j, i,
-							lm->lines[i].pgs_per_line);
-						erase_line(zms_ftl, &lm->lines[i].sub_lines[j], eio_type);
-						if (!direct_erase)
-							direct_erase = 1;
-					}
-				}
-			} else {
-				if (get_line_location(zms_ftl, &lm->lines[i]) == LOC_PSLC &&
-					line_reclaimable_without_copy(&lm->lines[i].sub_lines[j])) {
-					NVMEV_CONZONE_GC_DEBUG("try direct earse line %d pgs per line %ld\n", i,
-										   lm->lines[i].pgs_per_line);
-					erase_line(zms_ftl, &lm->lines[i], eio_type);
-					if (!direct_erase)
-						direct_erase = 1;
-				}
-			}
+		while (!list_empty(&lm->pslc_reclaim_list)) {
+			struct zms_line *line =
+				list_first_entry(&lm->pslc_reclaim_list, struct zms_line, reclaim_entry);
+
+			list_del_init(&line->reclaim_entry);
+			// written again since it was queued
+			if (!line_reclaimable_without_copy(line))
+				continue;
+
+			NVMEV_CONZONE_GC_DEBUG("try direct earse line %d parent id %d pgs per line %ld\n",
+								   line->id, line->parent_id, line->pgs_per_line);
+			erase_line(zms_ftl, line, eio_type);
+			direct_erase = 1;
 		}
 
 		if (direct_erase)
@@ -2492,6 +2895,61 @@ static void foreground_gc(struct zms_ftl *zms_ftl, int location)
 	}
 }
 
+static bool bg_should_reclaim(struct zms_ftl *zms_ftl, int location)
+{
+	int free_line_cnt =
+		location == LOC_PSLC ? zms_ftl->lm.pslc_free_line_cnt : zms_ftl->lm.free_line_cnt;
+
+	if (free_line_cnt <= zms_ftl->zp.bg_thres_lines_low)
+		zms_ftl->bg_reclaiming[location] = true;
+	else if (free_line_cnt >= zms_ftl->zp.bg_thres_lines_high)
+		zms_ftl->bg_reclaiming[location] = false;
+	return zms_ftl->bg_reclaiming[location];
+}
+
+/*
+ * Reclaim lines in the idle gap before a host request arrives at @nsecs_now. The internal nand
+ * commands are issued from the moment the device went idle, so the host request only waits for
+ * the part of the work that does not fit into the gap.
+ */
+static void background_reclaim(struct zms_ftl *zms_ftl, uint64_t nsecs_now)
+{
+	struct zms_line_mgmt *lm = &zms_ftl->lm;
+	bool is_meta = get_namespace_type(zms_ftl->zp.ns_type) == META_NAMESPACE;
+
+	if (!BG_RECLAIM_IDLE_NS || zms_ftl->device_full || zms_ftl->pslc_full)
+		return;
+
+	while (true) {
+		uint64_t idle_since = check_maxfreetime(zms_ftl);
+		int free_lines = lm->free_line_cnt + lm->pslc_free_line_cnt;
+
+		if (idle_since + BG_RECLAIM_IDLE_NS > nsecs_now)
+			break;
+
+		zms_ftl->current_time = idle_since;
+		zms_ftl->bg_stime = idle_since;
+		if (bg_should_reclaim(zms_ftl, LOC_PSLC)) {
+			if (SLC_BYPASS || is_meta)
+				do_gc(zms_ftl, false, LOC_PSLC);
+			else if (!check_migrating(zms_ftl))
+				try_migrate(zms_ftl, true);
+		}
+		// zoned namespaces reclaim normal lines by zone reset
+		if (lm->free_line_cnt + lm->pslc_free_line_cnt <= free_lines &&
+			(is_meta || zms_ftl->zp.ns_type == SSD_TYPE_CONZONE_BLOCK) &&
+			bg_should_reclaim(zms_ftl, LOC_NORMAL)) {
+			do_gc(zms_ftl, false, LOC_NORMAL);
+		}
+		zms_ftl->bg_stime = 0;
+
+		if (lm->free_line_cnt + lm->pslc_free_line_cnt <= free_lines)
+			break;
+		zms_ftl->bg_reclaim_cnt++;
+	}
+	zms_ftl->current_time = nsecs_now;
+}
+
 static uint32_t zns_write_check(struct zms_ftl *zms_ftl, struct nvme_rw_command *cmd)
 {
 	if (!is_zoned(zms_ftl->zp.ns_type))
@@ -2647,11 +3105,7 @@ static bool __zms_wb_hit(struct zms_ftl *zms_ftl, struct buffer *write_buffer, u
 		}
 		return false;
 	} else {
-		for (int i = 0; i < write_buffer->pgs; i++) {
-			if (write_buffer->lpns[i] == lpn)
-				return true;
-		}
-		return false;
+		return buffer_has_lpn(write_buffer, lpn);
 	}
 }
 
@@ -2726,33 +3180,38 @@ uint64_t buffer_flush(struct zms_ftl *zms_ftl, struct buffer *write_buffer, uint
 		// Overwriting the updated LPNs in the aggregation array, eliminating duplicate LPNs.
 		// Note that there are no duplicate LPNs in write_buffer->lpns
 		if (zms_ftl->zp.ns_type == SSD_TYPE_CONZONE_BLOCK) {
+			// Drop the overwritten LPNs from the index, then compact the array once.
 			if (agg_len > 0) {
+				bool dropped = false;
 				for (int i = 0; i < write_buffer->pgs; i++) {
+					if (lpn_set_del(&zms_ftl->zone_agg_set, write_buffer->lpns[i]))
+						dropped = true;
+				}
+				if (dropped) {
+					int len = 0;
 					for (int j = 0; j < agg_len; j++) {
-						if (agg_lpns[j] == write_buffer->lpns[i]) {
-							for (int k = j + 1; k < agg_len; k++) {
-								agg_lpns[k - 1] = agg_lpns[k];
-							}
-							agg_len--;
-							break;
-						}
+						if (lpn_set_has(&zms_ftl->zone_agg_set, agg_lpns[j]))
+							agg_lpns[len++] = agg_lpns[j];
 					}
+					agg_len = len;
 				}
 				zms_ftl->zone_agg_pgs[agg_idx] = agg_len;
 			}
 
 			// If the user updates misaligned GC data, we first need to delete it from gc_agg_lpn.
 			if (zms_ftl->gc_agg_len > 0) {
+				bool dropped = false;
 				for (int i = 0; i < write_buffer->pgs; i++) {
+					if (lpn_set_del(&zms_ftl->gc_agg_set, write_buffer->lpns[i]))
+						dropped = true;
+				}
+				if (dropped) {
+					int len = 0;
 					for (int j = 0; j < zms_ftl->gc_agg_len; j++) {
-						if (zms_ftl->gc_agg_lpns[j] == write_buffer->lpns[i]) {
-							for (int k = j + 1; k < zms_ftl->gc_agg_len; k++) {
-								zms_ftl->gc_agg_lpns[k - 1] = zms_ftl->gc_agg_lpns[k];
-							}
-							zms_ftl->gc_agg_len--;
-							break;
-						}
+						if (lpn_set_has(&zms_ftl->gc_agg_set, zms_ftl->gc_agg_lpns[j]))
+							zms_ftl->gc_agg_lpns[len++] = zms_ftl->gc_agg_lpns[j];
 					}
+					zms_ftl->gc_agg_len = len;
 				}
 			}
 		}
@@ -2793,7 +3252,7 @@ uint64_t buffer_flush(struct zms_ftl *zms_ftl, struct buffer *write_buffer, uint
 			NVMEV_CONZONE_PRINT_TIME("%s latest %llu complete %llu lat %llu us\n", __func__,
 									 nsecs_latest, complete_time,
 									 (nsecs_latest - nsecs_start) / 1000);
-			zms_ftl->zone_agg_pgs[agg_idx] = 0;
+			zone_agg_reset(zms_ftl, agg_idx);
 		} else {
 			uint64_t pgs_per_oneshotpg =
 				(loc == LOC_PSLC) ? spp->pslc_pgs_per_oneshotpg : spp->pgs_per_oneshotpg;
@@ -2807,7 +3266,7 @@ uint64_t buffer_flush(struct zms_ftl *zms_ftl, struct buffer *write_buffer, uint
 						/* update old page information first */
 						mark_page_invalid(zms_ftl, &ppa);
 						set_rmap_ent(zms_ftl, INVALID_LPN, &ppa);
-						zms_ftl->maptbl[lpn].ppa = UNMAPPED_PPA;
+						clear_maptbl_ent(zms_ftl, lpn);
 
 					} else {
 						NVMEV_ERROR("2551 update in zoned storage?? lpn %lld loc %d ppa loc %d\n",
@@ -2819,6 +3278,7 @@ uint64_t buffer_flush(struct zms_ftl *zms_ftl, struct buffer *write_buffer, uint
 				if (SLC_BYPASS && get_namespace_type(zms_ftl->zp.ns_type) != META_NAMESPACE &&
 					loc == LOC_PSLC) {
 					zms_ftl->zone_agg_lpns[agg_idx][agg_len] = lpn;
+					lpn_set_add(&zms_ftl->zone_agg_set, lpn);
 					agg_len++;
 				}
 				to_write_pgs++;
@@ -2862,10 +3322,7 @@ uint64_t buffer_flush(struct zms_ftl *zms_ftl, struct buffer *write_buffer, uint
 	}
 
 	write_buffer->flush_data = 0;
-	for (int i = 0; i < write_buffer->pgs; i++) {
-		write_buffer->lpns[i] = INVALID_LPN;
-	}
-	write_buffer->pgs = 0;
+	buffer_clear_lpns(write_buffer);
 	write_buffer->zid = -1;
 	write_buffer->time = nsecs_latest;
 	write_buffer->flush_timestamp = nsecs_latest;
@@ -2894,27 +3351,12 @@ static bool handle_write_request(struct zms_ftl *zms_ftl, struct nvmev_request *
 		goto out;
 	}
 
+	background_reclaim(zms_ftl, nsecs_start);
+
 	if (zms_ftl->pending_for_migrating) {
-		int migrating = 0;
-		int lun, ch;
-		struct ppa ppa;
-		ppa.ppa = 0;
-		uint64_t max_migrating_etime = 0;
-		for (lun = 0; lun < spp->luns_per_ch; lun++) {
-			for (ch = 0; ch < spp->nchs; ch++) {
-				struct nand_lun *lunp;
-
-				ppa.g.ch = ch;
-				ppa.g.lun = lun;
-				ppa.g.pl = 0;
-				lunp = get_lun(zms_ftl->ssd, &ppa);
-				if (lunp->migrating && (lunp->migrating_etime > zms_ftl->current_time ||
-										lunp->migrating_etime > nsecs_start)) {
-					max_migrating_etime = max(max_migrating_etime, lunp->migrating_etime);
-					migrating = 1;
-				}
-			}
-		}
+		uint64_t max_migrating_etime = zms_ftl->ssd->migrating_etime;
+		int migrating = luns_migrating_after(zms_ftl, min(zms_ftl->current_time, nsecs_start));
+
 		if (migrating) {
 			// NVMEV_INFO(
 			// 	"ns %d pending for migrating current time %lld m_etime %lld duration %lld us\n",
@@ -3024,10 +3466,9 @@ static bool handle_write_request(struct zms_ftl *zms_ftl, struct nvmev_request *
 		if (wpgs == 0)
 			continue;
 
-		for (i = write_buffer->pgs, j = 0; i < write_buffer->pgs + wpgs && j < wpgs; i++, j++) {
-			write_buffer->lpns[i] = lpns != NULL ? lpns[j] : lpn + j;
+		for (j = 0; j < wpgs; j++) {
+			buffer_add_lpn(write_buffer, lpns != NULL ? lpns[j] : lpn + j);
 		}
-		write_buffer->pgs += wpgs;
 		write_buffer->flush_data += spp->pgsz * wpgs;
 		if (lpns) {
 			kfree(lpns);
@@ -3108,6 +3549,64 @@ out:
 	return true;
 }
 
+// fetch the map entry covering lpn into the l2p cache
+static void map_prefetch(struct zms_ftl *zms_ftl, uint64_t lpn, uint64_t nsecs_start)
+{
+	int sidx = (is_zoned(zms_ftl->zp.ns_type) && L2P_HYBRID_MAP) ? 0 : NUM_MAP - 1;
+
+	for (int i = sidx; i < NUM_MAP; i++) {
+		uint64_t map_slpn = get_granularity_start_lpn(zms_ftl, lpn, MAP_GRAN(i));
+		struct ppa ppa = get_maptbl_ent(zms_ftl, map_slpn);
+		if (!mapped_ppa(&ppa) || ppa.zms.map != MAP_GRAN(i))
+			continue;
+		if (get_l2pcacheidx(zms_ftl, map_slpn) != -1)
+			return;
+
+		nand_read(zms_ftl, &map_slpn, 0, 1, MAP_READ_IO, nsecs_start);
+		set_l2pcacheidx(zms_ftl, map_slpn,
+						l2p_insert(zms_ftl, map_slpn, MAP_GRAN(i), check_resident(zms_ftl, MAP_GRAN(i))));
+		zms_ftl->l2p_prefetches++;
+		return;
+	}
+}
+
+/*
+ * Called on every map miss. Once L2P_STREAM_THRESHOLD misses arrive at the same
+ * stride, the next L2P_STREAM_DEPTH map entries along the stream are read in the
+ * background: they occupy the flash but the host request does not wait for them.
+ * A miss right past a prefetched window keeps the stream alive.
+ */
+static void map_stream_detect(struct zms_ftl *zms_ftl, uint64_t lpn, uint64_t nsecs_start)
+{
+	struct l2p_stream *st = &zms_ftl->stream;
+	int64_t delta = (int64_t)(lpn - st->last_miss);
+
+	if (!L2P_STREAM_THRESHOLD)
+		return;
+
+	if (st->hits >= L2P_STREAM_THRESHOLD && lpn == st->next) {
+		/* stream continues past the prefetched window */
+	} else if (delta != 0 && delta == st->stride) {
+		st->hits++;
+	} else {
+		st->stride = delta;
+		st->hits = 1;
+	}
+	st->last_miss = lpn;
+
+	if (st->hits < L2P_STREAM_THRESHOLD)
+		return;
+
+	uint64_t pf_lpn = lpn;
+	for (int i = 0; i < L2P_STREAM_DEPTH; i++) {
+		pf_lpn += st->stride;
+		if (pf_lpn >= zms_ftl->zp.tt_lpns)
+			break;
+		map_prefetch(zms_ftl, pf_lpn, nsecs_start);
+	}
+	st->next = pf_lpn + st->stride;
+}
+
 static uint64_t map_read(struct zms_ftl *zms_ftl, uint64_t lpn, uint64_t nsecs_start)
 {
 	struct ssdparams *spp = &zms_ftl->ssd->sp;
@@ -3127,11 +3626,10 @@ static uint64_t map_read(struct zms_ftl *zms_ftl, uint64_t lpn, uint64_t nsecs_s
 			int is_resident = check_resident(zms_ftl, MAP_GRAN(i));
 			cache_idx = l2p_insert(zms_ftl, map_slpn, MAP_GRAN(i), is_resident);
 			set_l2pcacheidx(zms_ftl, map_slpn, cache_idx);
+			// inserted at the tail already; an access here would promote it past 2Q's A1
 			if (cache_idx == -1) {
 				NVMEV_INFO("l2p insert failed?? map slpn %lld mapgran %d isresident %d\n", map_slpn,
 						   MAP_GRAN(i), is_resident);
-			} else {
-				l2p_access(zms_ftl, map_slpn, cache_idx);
 			}
 
 			if (MAP_GRAN(i) == PAGE_MAP) {
@@ -3155,6 +3653,7 @@ static uint64_t map_read(struct zms_ftl *zms_ftl, uint64_t lpn, uint64_t nsecs_s
 		}
 	}
 
+	map_stream_detect(zms_ftl, lpn, nsecs_map_latest);
 	return nsecs_map_latest;
 }
 
@@ -3178,6 +3677,7 @@ static bool handle_read_request(struct zms_ftl *zms_ftl, struct nvmev_request *r
 	uint64_t wb_read_pgs = 0;
 
 	zms_ftl->current_time = nsecs_start;
+	background_reclaim(zms_ftl, nsecs_start);
 
 	// get delay from nand model
 	nsecs_latest = nsecs_start;
@@ -3204,13 +3704,9 @@ static bool handle_read_request(struct zms_ftl *zms_ftl, struct nvmev_request *r
 		}
 
 		// check if this page in gc buffer
-		if (zms_ftl->gc_agg_len > 0) {
-			for (int i = 0; i < zms_ftl->gc_agg_len; i++) {
-				if (zms_ftl->gc_agg_lpns[i] == lpn) {
-					wb_read_pgs++;
-					continue;
-				}
-			}
+		if (zms_ftl->gc_agg_len > 0 && lpn_set_has(&zms_ftl->gc_agg_set, lpn)) {
+			wb_read_pgs++;
+			continue;
 		}
 
 		// L2P Search
@@ -3344,6 +3840,22 @@ out:
 	return true;
 }
 
+/* does the write buffer hold data of [slpn, elpn] */
+static bool __zms_wb_overlaps(struct zms_ftl *zms_ftl, struct buffer *write_buffer, uint64_t slpn,
+							  uint64_t elpn)
+{
+	if (__zms_wb_check(zms_ftl, write_buffer, slpn) != SUCCESS || write_buffer->zid == -1 ||
+		!write_buffer->pgs || write_buffer->lpns[0] == INVALID_LPN)
+		return false;
+	return write_buffer->lpns[0] <= elpn && write_buffer->lpns[0] + write_buffer->pgs > slpn;
+}
+
+/*
+ * Only the written part of a zone costs anything: a leaf that lies inside the
+ * zone is visited over its mapped run (extent) or entries (expanded) and then
+ * dropped as a whole, so empty and reserved-only leaves are skipped. Leaves
+ * shared with a neighbour zone are cleared entry by entry.
+ */
 void zone_reset(struct zms_ftl *zms_ftl, uint64_t zid, int sqid)
 {
 	uint64_t slpn = zone_to_slpn((struct zns_ftl *)(&(*zms_ftl)), zid);
@@ -3357,20 +3869,44 @@ void zone_reset(struct zms_ftl *zms_ftl, uint64_t zid, int sqid)
 	int pslc_invalid = 0;
 	int normal_invalid = 0;
 
-	for (lpn = slpn; lpn <= elpn; lpn++) {
-		ppa = get_maptbl_ent(zms_ftl, lpn);
-		if (mapped_ppa(&ppa)) {
+	if (write_buffer && __zms_wb_overlaps(zms_ftl, write_buffer, slpn, elpn))
+		bufs_to_release = write_buffer->flush_data;
+
+	for (lpn = slpn; lpn <= elpn;) {
+		struct maptbl_leaf *leaf = get_maptbl_leaf(zms_ftl, lpn);
+		uint32_t off = lpn & (MAPTBL_LEAF_PGS - 1);
+		uint64_t base = lpn - off;
+		uint64_t leaf_elpn = base + maptbl_leaf_pgs(zms_ftl, lpn) - 1;
+		uint32_t end = min_t(uint64_t, leaf_elpn, elpn) - base + 1;
+		bool whole = (off == 0 && leaf_elpn <= elpn);
+
+		if (whole && !leaf->pages) {
+			// nothing but [skip, len) of an extent leaf is mapped
+			off = leaf->skip;
+			end = leaf->len;
+		}
+
+		for (; off < end; off++) {
+			ppa = maptbl_leaf_ent(zms_ftl, leaf, off);
+			if (!mapped_ppa(&ppa)) {
+				// clear reserve mapping
+				if (!whole)
+					clear_maptbl_ent(zms_ftl, base + off);
+				continue;
+			}
+
 			mark_page_invalid(zms_ftl, &ppa);
 			set_rmap_ent(zms_ftl, INVALID_LPN, &ppa);
-			zms_ftl->maptbl[lpn].ppa = UNMAPPED_PPA;
+			if (!whole)
+				clear_maptbl_ent(zms_ftl, base + off);
 			if (get_page_location(zms_ftl, &ppa) == LOC_PSLC)
 				pslc_invalid++;
 			else
 				normal_invalid++;
 
 			if (r_slpn > elpn)
-				r_slpn = lpn;
-			r_elpn = lpn;
+				r_slpn = base + off;
+			r_elpn = base + off;
 
 			line = get_line(zms_ftl, &ppa);
 			if (first_line == NULL)
@@ -3379,16 +3915,11 @@ void zone_reset(struct zms_ftl *zms_ftl, uint64_t zid, int sqid)
 				erase_linked_lines(zms_ftl, first_line, USER_IO);
 				first_line = NULL;
 			}
-		} else {
-			if (write_buffer && __zms_wb_check(zms_ftl, write_buffer, slpn) == SUCCESS &&
-				__zms_wb_hit(zms_ftl, write_buffer, lpn)) {
-				bufs_to_release = write_buffer->flush_data;
-			}
-			// clear reserve mapping
-			if (zms_ftl->maptbl[lpn].ppa != UNMAPPED_PPA) {
-				zms_ftl->maptbl[lpn].ppa = UNMAPPED_PPA;
-			}
 		}
+
+		if (whole)
+			maptbl_leaf_reset(zms_ftl, leaf);
+		lpn = leaf_elpn + 1;
 	}
 
 	// erase lines
@@ -3398,17 +3929,14 @@ void zone_reset(struct zms_ftl *zms_ftl, uint64_t zid, int sqid)
 
 	// different zones should not share a write buffer
 	if (write_buffer && bufs_to_release) {
-		for (int i = 0; i < write_buffer->pgs; i++) {
-			write_buffer->lpns[i] = INVALID_LPN;
-		}
+		buffer_clear_lpns(write_buffer);
 		write_buffer->flush_data = 0;
-		write_buffer->pgs = 0;
 		write_buffer->zid = -1;
 		write_buffer->sqid = -1;
 		NVMEV_CONZONE_GC_DEBUG("ns %d Evict write buffer\n", zms_ftl->zp.ns->id);
 	}
 
-	zms_ftl->zone_agg_pgs[zid] = 0;
+	zone_agg_reset(zms_ftl, zid);
 	zms_ftl->zone_reset_cnt++;
 	NVMEV_CONZONE_GC_DEBUG("ns %d Zone %lld (%lld-%lld) vs [%lld-%lld] Reset. pSLC lines: "
 						   "%d/%d/%d/%d, normal lines %d/%d/%d/%d "
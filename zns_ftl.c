@@ -38,6 +38,12 @@ static void __init_buffer(struct zns_ftl *zns_ftl)
 		for (int i = 0; i < nr_zone_wb; i++) {
 			buffer_init(&(zns_ftl->zone_write_buffer[i]), wb_size);
 			zns_ftl->zone_write_buffer[i].ns_type = zns_ftl->zp.ns_type;
+#if (BASE_SSD == CONZONE_PROTOTYPE)
+			/* zoned buffers hold one sequential range, hit checks need no index */
+			if (!is_zoned(zns_ftl->zp.ns_type))
+				lpn_set_init(&(zns_ftl->zone_write_buffer[i].lpn_idx),
+							 zns_ftl->zone_write_buffer[i].tt_lpns);
+#endif
 		}
 
 		NVMEV_INFO("[Size of Each Write Buffer] %d KiB [LPNs per Write Buffer] %llu\n",
@@ -358,6 +364,9 @@ static void zms_init_params(struct znsparams *zpp, uint64_t physical_size, struc
 		.physical_size = physical_size,
 		.gc_thres_lines_high = 2,
 		.migrate_thres_lines_low = 2,
+		.bg_thres_lines_low = BG_THRES_LINES_LOW,
+		.bg_thres_lines_high = BG_THRES_LINES_HIGH,
+		.gc_victim_policy = nvmev_vdev->config.gc_victim_policy,
 		.enable_gc_delay = 1,
 		.nr_zrwa_zones = 0,
 	};
@@ -460,7 +469,6 @@ static void zms_init_ftl(struct zms_ftl *zms_ftl, struct znsparams *zpp, void *m
 
 static void __init_l2p(struct zms_ftl *zms_ftl)
 {
-	int i, j;
 	struct znsparams *zpp = &zms_ftl->zp;
 	struct ssd *ssd = zms_ftl->ssd;
 	if (!ssd) {
@@ -469,19 +477,31 @@ static void __init_l2p(struct zms_ftl *zms_ftl)
 	}
 
 	zpp->tt_lpns = DIV_ROUND_UP(zpp->logical_size, ssd->sp.pgsz);
-	zms_ftl->maptbl = vmalloc(sizeof(struct ppa) * (zpp->tt_lpns));
-	zms_ftl->l2pcache_idx = vmalloc(sizeof(struct ppa) * (zpp->tt_lpns));
-	for (i = 0; i < zpp->tt_lpns; i++) {
-		zms_ftl->maptbl[i].ppa = UNMAPPED_PPA;
-		zms_ftl->l2pcache_idx[i] = -1;
-	}
+	/* all leaves start as empty extents */
+	zms_ftl->nr_maptbl_leaves = DIV_ROUND_UP(zpp->tt_lpns, MAPTBL_LEAF_PGS);
+	zms_ftl->maptbl = vzalloc(sizeof(struct maptbl_leaf) * zms_ftl->nr_maptbl_leaves);
+	zms_ftl->maptbl_expanded = 0;
+	/* zeroed: no page is cached, see set_l2pcacheidx() */
+	zms_ftl->l2pcache_idx = vzalloc(sizeof(int) * (zpp->tt_lpns));
+
+	zms_ftl->map_log_len = 0;
+
+	if (zpp->ns->id < NR_NAMESPACES)
+		ssd->l2pcache.owner[zpp->ns->id] = zms_ftl;
+	else
+		NVMEV_ERROR("%s nsid %d has no l2p partition\n", __func__, zpp->ns->id);
 
 	NVMEV_INFO("[# of L2P Entries (cached/all)] %d / %lld [Evict Policy] %d [Pre Read Pages] %d\n",
 			   ssd->l2pcache.size, zpp->tt_lpns, ssd->l2pcache.evict_policy, zms_ftl->zp.pre_read);
+	if (zpp->ns->id < NR_NAMESPACES && ssd->l2pcache.quota[zpp->ns->id])
+		NVMEV_INFO("[L2P Quota per Slot] %d / %d\n", ssd->l2pcache.quota[zpp->ns->id],
+				   ssd->l2pcache.slot_size);
 }
 
 static void __remove_l2p(struct zms_ftl *zms_ftl)
 {
+	for (uint64_t i = 0; i < zms_ftl->nr_maptbl_leaves; i++)
+		kfree(zms_ftl->maptbl[i].pages);
 	vfree(zms_ftl->maptbl);
 	vfree(zms_ftl->l2pcache_idx);
 }
@@ -536,6 +556,7 @@ static void __init_sublines(struct zms_ftl *zms_ftl, struct zms_line *line)
 			.pos = 0,
 			.rpc = 0,
 			.entry = LIST_HEAD_INIT(line->sub_lines[i].entry),
+			.reclaim_entry = LIST_HEAD_INIT(line->sub_lines[i].reclaim_entry),
 			.mid.parent_id = line->id,
 			.mid.id = i,
 			.mid.entry = LIST_HEAD_INIT(line->sub_lines[i].mid.entry),
@@ -576,6 +597,7 @@ static void __init_lines(struct zms_ftl *zms_ftl, int pSLC_eline, int interleave
 									 victim_line_set_pri, victim_line_get_pos, victim_line_set_pos);
 	INIT_LIST_HEAD(&lm->pslc_free_line_list);
 	INIT_LIST_HEAD(&lm->pslc_full_line_list);
+	INIT_LIST_HEAD(&lm->pslc_reclaim_list);
 
 	lm->pslc_victim_line_pq =
 		pqueue_init(lm->tt_lines, victim_line_cmp_pri, victim_line_get_pri, victim_line_set_pri,
@@ -592,6 +614,7 @@ static void __init_lines(struct zms_ftl *zms_ftl, int pSLC_eline, int interleave
 			.pos = 0,
 			.rpc = 0,
 			.entry = LIST_HEAD_INIT(lm->lines[i].entry),
+			.reclaim_entry = LIST_HEAD_INIT(lm->lines[i].reclaim_entry),
 			.mid.parent_id = -1,
 			.mid.id = i,
 			.mid.entry = LIST_HEAD_INIT(lm->lines[i].mid.entry),
@@ -828,6 +851,7 @@ static void zms_realize_ftl(struct zms_ftl *zms_ftl)
 	zms_ftl->gc_agg_len = 0;
 	zms_ftl->gc_agg_ttlpns = ssd->sp.pgs_per_oneshotpg;
 	zms_ftl->gc_agg_lpns = kmalloc(sizeof(uint64_t) * zms_ftl->gc_agg_ttlpns, GFP_KERNEL);
+	lpn_set_init(&zms_ftl->gc_agg_set, zms_ftl->gc_agg_ttlpns);
 	NVMEV_INFO("[GC Agg Buffer Size] %d lpns\n", zms_ftl->gc_agg_ttlpns);
 	// for pSLC->QLC migration in zoned device
 	zms_ftl->num_aggs = 1;
@@ -842,6 +866,10 @@ static void zms_realize_ftl(struct zms_ftl *zms_ftl)
 		zms_ftl->zone_agg_lpns[i] = kmalloc(
 			sizeof(uint64_t) * (zpp->pslc_pgs_per_line + zms_ftl->zone_write_unit), GFP_KERNEL);
 	}
+	// only the block namespace looks LPNs up in its aggregation array
+	zms_ftl->zone_agg_set.slots = NULL;
+	if (zms_ftl->zp.ns_type == SSD_TYPE_CONZONE_BLOCK)
+		lpn_set_init(&zms_ftl->zone_agg_set, zpp->pslc_pgs_per_line + zms_ftl->zone_write_unit);
 
 	NVMEV_INFO("[Num Aggs] %d\n", zms_ftl->num_aggs);
 	zms_ftl->migrating_line_pq =
@@ -859,11 +887,6 @@ static void zms_realize_ftl(struct zms_ftl *zms_ftl)
 	// zms_ftl->ws.common_lpns = kvmalloc(sizeof(uint64_t) * 2048, GFP_KERNEL);
 	// zms_ftl->ws.gc_lpns = kvmalloc(sizeof(uint64_t) * 2048, GFP_KERNEL);
 
-	// char cache_name[32];
-	// snprintf(cache_name, 32, "zms_cmd_cache_%d", zms_ftl->zp.ns->id);
-	// zms_ftl->cmd_cache =
-	// 	kmem_cache_create(cache_name, sizeof(struct nand_cmd), 0, SLAB_HWCACHE_ALIGN, NULL);
-
 	// NVMEV_INFO("ZMS FTL Workspace & Cache Initialized\n");
 }
 
@@ -897,6 +920,12 @@ void zms_init_namespace(struct nvmev_ns *ns, uint32_t id, uint64_t size, void *m
 	return;
 }
 
+static const char *const gc_victim_policy_str[] = {
+	[GC_VICTIM_GREEDY] = "greedy",
+	[GC_VICTIM_COST_BENEFIT] = "cost-benefit",
+	[GC_VICTIM_WINDOWED] = "windowed",
+};
+
 void zms_print_statistic_info(struct zms_ftl *zms_ftl)
 {
 	NVMEV_INFO("------------MISAO--device %d statistic info-----------\n", zms_ftl->zp.ns->id);
@@ -908,11 +937,17 @@ void zms_print_statistic_info(struct zms_ftl *zms_ftl)
 	NVMEV_INFO("[L2P Miss Rate] (%lld/%lld) [WB Hits] %lld [Unmapped Read Cnt] %lld\n",
 			   zms_ftl->l2p_misses, zms_ftl->l2p_misses + zms_ftl->l2p_hits, zms_ftl->read_wb_hits,
 			   zms_ftl->unmapped_read_cnt);
+	NVMEV_INFO("[# of L2P Prefetches] %lld [Map Write Pgs] %lld\n", zms_ftl->l2p_prefetches,
+			   zms_ftl->map_w_pgs);
+	NVMEV_INFO("[Maptbl Leaves] %lld/%lld (per-page/all)\n", zms_ftl->maptbl_expanded,
+			   zms_ftl->nr_maptbl_leaves);
 	NVMEV_INFO("[WAF] (%lld/%lld) [RAF] (%lld/%lld)\n", zms_ftl->device_w_pgs, zms_ftl->host_w_pgs,
 			   zms_ftl->device_r_pgs, zms_ftl->host_r_pgs);
 	NVMEV_INFO("[# of Normal Line Earse] %d [# of pSLC Line Erase] %d\n", zms_ftl->normal_erase_cnt,
 			   zms_ftl->slc_erase_cnt);
-	NVMEV_INFO("[# of Garbage Collection] %d\n", zms_ftl->gc_count);
+	NVMEV_INFO("[# of Garbage Collection] %d (%s) [# of Background Reclamation] %d\n",
+			   zms_ftl->gc_count, gc_victim_policy_str[zms_ftl->zp.gc_victim_policy],
+			   zms_ftl->bg_reclaim_cnt);
 	NVMEV_INFO("[# of Migration] %d [# of Should-migrate] %d\n", zms_ftl->migrate_count,
 			   zms_ftl->should_migrate_times);
 	NVMEV_INFO("[# of Early Flush] %d\n", zms_ftl->early_flush_cnt);
@@ -947,8 +982,10 @@ void zms_remove_namespace(struct nvmev_ns *ns)
 		kfree(zms_ftl->zone_agg_lpns[i]);
 	}
 	kfree(zms_ftl->zone_agg_lpns);
+	lpn_set_free(&zms_ftl->zone_agg_set);
 	pqueue_free(zms_ftl->migrating_line_pq);
 	kfree(zms_ftl->gc_agg_lpns);
+	lpn_set_free(&zms_ftl->gc_agg_set);
 	kfree(zms_ftl->read_prev_ppas);
 	kfree(zms_ftl->read_agg_size);
 	// kvfree(zms_ftl->ws.read_prev_ppas);
@@ -956,8 +993,6 @@ void zms_remove_namespace(struct nvmev_ns *ns)
 	// kvfree(zms_ftl->ws.common_lpns);
 	// kvfree(zms_ftl->ws.gc_lpns);
 
-	// if (zms_ftl->cmd_cache)
-	// 	kmem_cache_destroy(zms_ftl->cmd_cache);
 	kfree(zms_ftl);
 
 	ns->ftls = NULL;
@@ -982,6 +1017,9 @@ void zms_realize_namespaces(struct nvmev_ns *ns, int nr_ns, uint64_t size,
 	ssd = kmalloc(sizeof(struct ssd), GFP_KERNEL);
 	memset(&spp, 0, sizeof(struct ssdparams));
 	ssd_init_params(&spp, size, nr_parts);
+	spp.l2p_cache_size = nvmev_vdev->config.l2p_cache_size;
+	spp.l2p_cache_slots = nvmev_vdev->config.l2p_cache_slots;
+	spp.l2p_evict_policy = nvmev_vdev->config.l2p_evict_policy;
 	ssd_init(ssd, &spp, cpu_nr_dispatcher);
 
 	for (i = 0; i < nr_ns; i++) {
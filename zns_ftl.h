@@ -92,6 +92,9 @@ struct znsparams {
 	uint64_t tt_ppns;
 	uint32_t gc_thres_lines_high;
 	uint32_t migrate_thres_lines_low;
+	uint32_t bg_thres_lines_low;  // background reclamation starts
+	uint32_t bg_thres_lines_high; // background reclamation stops
+	int gc_victim_policy;
 	bool enable_gc_delay;
 };
 
@@ -139,6 +142,8 @@ struct zms_line {
 	unsigned long pgs_per_line;
 	// for rsv multiple lines
 	struct zms_line *rsv_nextline;
+	uint64_t inv_time; /* last time a page of this line was invalidated */
+	struct list_head reclaim_entry; /* on pslc_reclaim_list */
 };
 
 /* wp: record next write addr */
@@ -173,6 +178,9 @@ struct zms_line_mgmt {
 	uint32_t pslc_free_line_cnt;
 	uint32_t pslc_victim_line_cnt;
 	uint32_t pslc_full_line_cnt;
+
+	/* pSLC lines that became erasable without copy, rechecked when popped */
+	struct list_head pslc_reclaim_list;
 };
 
 struct zms_write_flow_control {
@@ -180,6 +188,34 @@ struct zms_write_flow_control {
 	long int credits_to_refill;
 };
 
+/*
+ * maptbl is split into leaves of MAPTBL_LEAF_PGS lpns. A leaf filled by one
+ * sequential run (chunk/zone mappings) is kept as an extent: lpns below @skip
+ * are unmapped, [skip, len) follow @start (the entry at @sidx) page by page and
+ * the rest read as RSV_PPA or unmapped. Updates an extent cannot express expand
+ * the leaf into a per-page @pages array, freed again once it is all unmapped.
+ */
+#define MAPTBL_LEAF_SHIFT (9)
+#define MAPTBL_LEAF_PGS (1U << MAPTBL_LEAF_SHIFT)
+
+struct maptbl_leaf {
+	struct ppa *pages;
+	struct ppa start;
+	uint32_t sidx;
+	uint32_t skip;
+	uint32_t len;
+	uint32_t nr_used; // non-unmapped entries in @pages
+	bool tail_rsv;
+};
+
+/* sequential map-miss detector for L2P prefetch */
+struct l2p_stream {
+	uint64_t last_miss; // lpn of the last map miss
+	int64_t stride;
+	int hits;		  // consecutive misses at @stride
+	uint64_t next;	  // first lpn past the prefetched window
+};
+
 struct zms_workspace {
 	// Size：nchs * luns_per_ch * "pls_per_lun"(4)
 	struct ppa *read_prev_ppas;
@@ -206,8 +242,12 @@ struct zms_ftl {
 
 	uint64_t current_time;
 	// l2p
-	struct ppa *maptbl;
-	int *l2pcache_idx;
+	struct maptbl_leaf *maptbl;
+	uint64_t nr_maptbl_leaves;
+	uint64_t maptbl_expanded; // leaves holding per-page entries
+	int *l2pcache_idx; // cache index + 1 per page, 0 if not cached
+	struct l2p_stream stream;
+	int map_log_len;		 // dirty map entries waiting to be programmed
 
 	struct zms_line_mgmt lm;
 	// pSLC
@@ -230,15 +270,21 @@ struct zms_ftl {
 	int pslc_full;
 	int pending_for_migrating;
 
+	// background reclamation
+	bool bg_reclaiming[2]; // per location, between the two bg watermarks
+	uint64_t bg_stime;	   // start time of internal nand cmds, 0: now
+
 	// GC
 	uint64_t *gc_agg_lpns;
 	int gc_agg_len;
 	int gc_agg_ttlpns;
+	struct lpn_set gc_agg_set; // lpns in gc_agg_lpns
 
 	// Migration
 	int num_aggs;
 	int *zone_agg_pgs;
 	uint64_t **zone_agg_lpns; // agg lpn
+	struct lpn_set zone_agg_set; // lpns in zone_agg_lpns, block namespace only
 	int zone_write_unit;	  // oneshot page for normal blocks
 
 	pqueue_t *migrating_line_pq;
@@ -251,6 +297,8 @@ struct zms_ftl {
 	uint64_t gc_pgs;
 	uint64_t l2p_misses;
 	uint64_t l2p_hits;
+	uint64_t l2p_prefetches;
+	uint64_t map_w_pgs; // map log programs, included in device_w_pgs
 	uint64_t read_wb_hits;
 	uint64_t unmapped_read_cnt;
 	uint64_t host_r_pgs;
@@ -266,6 +314,7 @@ struct zms_ftl {
 	uint32_t normal_erase_cnt;
 	uint32_t slc_erase_cnt;
 	int gc_count;
+	int bg_reclaim_cnt;
 	int migrate_count;
 	int should_migrate_times;
 	int early_flush_cnt;
@@ -279,8 +328,6 @@ struct zms_ftl {
 	struct zms_workspace ws;
 	struct ppa *read_prev_ppas;
 	uint64_t *read_agg_size;
-	// Slab Cache for nand_cmd
-	struct kmem_cache *cmd_cache;
 };
 
 /* zns internal functions */